@@ -0,0 +1 @@
+../../src/ddb_bitmap.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ddb_cache.c
\ No newline at end of file
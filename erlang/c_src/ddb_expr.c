@@ -0,0 +1 @@
+../../src/ddb_expr.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ddb_facet.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ddb_match.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/ddb_parallel.c
\ No newline at end of file
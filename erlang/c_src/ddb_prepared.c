@@ -0,0 +1 @@
+../../src/ddb_prepared.c
\ No newline at end of file
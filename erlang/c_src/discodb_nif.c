@@ -19,6 +19,7 @@
 #define ATOM_ECREAT              ATOM("ecreat")
 #define ATOM_ERROR               ATOM("error")
 #define ATOM_NO                  ATOM("no")
+#define ATOM_META                ATOM("meta")
 #define ATOM_NULL                ATOM("null")
 
 #define ATOM_DISCODB_CONS        ATOM("discodb_cons")
@@ -177,6 +178,40 @@ ErlDDBIter_next(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
   return result;
 }
 
+static ERL_NIF_TERM
+ErlDDBIter_next_batch(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+  ErlDDBIter *iter;
+  unsigned max;
+  if (!enif_get_resource(env, argv[0], ErlDDBIterType, (void **)&iter))
+    return ERROR_BADARG;
+  if (!enif_get_uint(env, argv[1], &max))
+    return ERROR_BADARG;
+
+  ERL_NIF_TERM result = enif_make_list(env, 0);
+  if (!max)
+    return result;
+
+  struct ddb_entry *entries;
+  if (!(entries = enif_alloc(max * sizeof(struct ddb_entry))))
+    return ERROR_EALLOC;
+
+  int errcode;
+  uint32_t n = ddb_next_batch(iter->cursor, entries, max, &errcode);
+  if (errcode) {
+    enif_free(entries);
+    return enif_make_tuple2(env, ATOM_ERROR, enif_make_int(env, errcode));
+  }
+
+  while (n--) {
+    ERL_NIF_TERM entry;
+    unsigned char *data = enif_make_new_binary(env, entries[n].length, &entry);
+    memcpy(data, entries[n].data, entries[n].length);
+    result = enif_make_list_cell(env, entry, result);
+  }
+  enif_free(entries);
+  return result;
+}
+
 static ERL_NIF_TERM
 ErlDDBIter_size(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
   ErlDDBIter *iter;
@@ -445,61 +480,118 @@ ErlDiscoDB_iter_async(ErlDDB *ddb, Message *msg) {
 
 static void
 free_ddb_query_clauses(struct ddb_query_clause *clauses, uint32_t num_clauses) {
-  int i;
+  int i, j;
   if (clauses) {
     for (i = 0; i < num_clauses; i++)
-      if (clauses[i].terms)
+      if (clauses[i].terms) {
+        for (j = 0; j < clauses[i].num_terms; j++)
+          if (clauses[i].terms[j].type == DDB_TERM_META)
+            free_ddb_query_clauses((struct ddb_query_clause *) clauses[i].terms[j].clauses,
+                                   clauses[i].terms[j].num_clauses);
         free(clauses[i].terms);
+      }
     free(clauses);
   }
 }
 
-static ERL_NIF_TERM
-ErlDiscoDB_query_async(ErlDDB *ddb, Message *msg) {
-  ErlNifEnv *env = msg->env;
+/* A query is a list of clauses, each one a list of terms. A term is a
+   key, {no, Term} or {meta, Query}: the keys named by the values of
+   Query. Returns 0, or ERROR_BADARG / ERROR_ECREAT in *error. */
+static int
+get_ddb_query_clauses(ErlNifEnv *env,
+                      ERL_NIF_TERM clauses,
+                      struct ddb_query_clause **ddb_clauses,
+                      uint32_t *nclauses,
+                      ERL_NIF_TERM *error) {
   ErlNifBinary literal;
-  ERL_NIF_TERM clause, term, clauses = msg->term;
-  unsigned nclauses = 0, i, j;
-  struct ddb_query_clause *ddb_clauses = NULL;
-  struct ddb_cursor *cursor = NULL;
+  ERL_NIF_TERM clause, term;
+  unsigned length, i, j;
 
-  if (!enif_get_list_length(env, clauses, &nclauses))
+  *ddb_clauses = NULL;
+  *nclauses = 0;
+  if (!enif_get_list_length(env, clauses, &length))
     goto badarg;
 
-  if (!(ddb_clauses = calloc(nclauses, sizeof(struct ddb_query_clause))))
+  if (!(*ddb_clauses = calloc(length + 1, sizeof(struct ddb_query_clause))))
     goto ecreat;
+  *nclauses = length;
   for (i = 0; enif_get_list_cell(env, clauses, &clause, &clauses); i++) {
-    if (!enif_get_list_length(env, clause, &ddb_clauses[i].num_terms))
+    struct ddb_query_clause *c = &(*ddb_clauses)[i];
+    if (!enif_get_list_length(env, clause, &length))
       goto badarg;
 
-    if (!(ddb_clauses[i].terms = calloc(ddb_clauses[i].num_terms, sizeof(struct ddb_query_term))))
+    if (!(c->terms = calloc(length + 1, sizeof(struct ddb_query_term))))
       goto ecreat;
+    c->num_terms = length;
     for (j = 0; enif_get_list_cell(env, clause, &term, &clause); j++) {
+      struct ddb_query_term *t = &c->terms[j];
       int arity;
       const ERL_NIF_TERM *pair;
+      if (enif_get_tuple(env, term, &arity, &pair) && arity == 2 &&
+          TERM_EQ(pair[0], ATOM_NO)) {
+        t->nnot = 1;
+        term = pair[1];
+      }
       if (enif_get_tuple(env, term, &arity, &pair)) {
-        if (!(arity == 2 && TERM_EQ(pair[0], ATOM_NO)))
+        struct ddb_query_clause *sub;
+        if (!(arity == 2 && TERM_EQ(pair[0], ATOM_META)))
           goto badarg;
-        ddb_clauses[i].terms[j].nnot = 1;
-        term = pair[1];
+        t->type = DDB_TERM_META;
+        if (get_ddb_query_clauses(env, pair[1], &sub, &t->num_clauses, error)) {
+          free_ddb_query_clauses(sub, t->num_clauses);
+          t->type = 0;
+          goto fail;
+        }
+        t->clauses = sub;
+        continue;
       }
       if (!enif_inspect_iolist_as_binary(env, term, &literal))
         goto badarg;
-      ddb_clauses[i].terms[j].key.data = (char *) literal.data;
-      ddb_clauses[i].terms[j].key.length = literal.size;
+      t->key.data = (char *) literal.data;
+      t->key.length = literal.size;
     }
   }
+  return 0;
+ badarg:
+  *error = ERROR_BADARG;
+  return -1;
+ ecreat:
+  *error = ERROR_ECREAT;
+ fail:
+  return -1;
+}
+
+static ERL_NIF_TERM
+ErlDiscoDB_query_async(ErlDDB *ddb, Message *msg) {
+  ErlNifEnv *env = msg->env;
+  ERL_NIF_TERM error;
+  uint32_t nclauses;
+  struct ddb_query_clause *ddb_clauses = NULL;
+  struct ddb_cursor *cursor = NULL;
+
+  /* a binary is a query string, as in discodb:query(DB, <<"a & ~b">>) */
+  if (enif_is_binary(env, msg->term)) {
+    ErlNifBinary query;
+    struct ddb_prepared *prepared;
+    enif_inspect_binary(env, msg->term, &query);
+    if (!(prepared = ddb_prepare(ddb->db, (char *) query.data, query.size)))
+      return ASYNC(make_ddb_error(env, ddb));
+    cursor = ddb_prepared_query(prepared, NULL);
+    ddb_prepared_free(prepared);
+    if (!cursor)
+      return ASYNC(make_ddb_error(env, ddb));
+    return ASYNC(ErlDDBIter_new(env, ddb, cursor));
+  }
+
+  if (get_ddb_query_clauses(env, msg->term, &ddb_clauses, &nclauses, &error)) {
+    free_ddb_query_clauses(ddb_clauses, nclauses);
+    return ASYNC(error);
+  }
 
   if (!(cursor = ddb_query(ddb->db, ddb_clauses, nclauses)))
     goto equery;
   free_ddb_query_clauses(ddb_clauses, nclauses);
   return ASYNC(ErlDDBIter_new(env, ddb, cursor));
- badarg:
-  free_ddb_query_clauses(ddb_clauses, nclauses);
-  return ASYNC(ERROR_BADARG);
- ecreat:
-  free_ddb_query_clauses(ddb_clauses, nclauses);
-  return ASYNC(ERROR_ECREAT);
  equery:
   free_ddb_query_clauses(ddb_clauses, nclauses);
   return ASYNC(make_ddb_error(env, ddb));
@@ -578,6 +670,7 @@ static ErlNifFunc nif_funcs[] =
     {"init", 3, ErlDDB_init},
     {"call", 3, ErlDDB_call},
     {"next", 1, ErlDDBIter_next},
+    {"next_batch", 2, ErlDDBIter_next_batch},
     {"size", 1, ErlDDBIter_size},
     {"count", 1, ErlDDBIter_count},
   };
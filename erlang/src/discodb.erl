@@ -28,6 +28,7 @@
 
 -export([fold/3,
          next/1,
+         next_batch/2,
          size/1,
          count/1,
          to_list/1]).
@@ -41,6 +42,8 @@
          peek/3,
          peek/4]).
 
+-define(BATCH_SIZE, 256).
+
 str(Bin) when is_binary(Bin) ->
     binary_to_list(Bin);
 str(Str) when is_list(Str) ->
@@ -145,6 +148,9 @@ fold(Iter, Fun, Acc) ->
 next(Iter) ->
     discodb_nif:next(Iter).
 
+next_batch(Iter, Max) ->
+    discodb_nif:next_batch(Iter, Max).
+
 size(Iter) ->
     discodb_nif:size(Iter).
 
@@ -152,7 +158,14 @@ count(Iter) ->
     discodb_nif:count(Iter).
 
 to_list(Iter) ->
-    lists:reverse(fold(Iter, fun (E, Acc) -> [E|Acc] end, [])).
+    to_list(Iter, next_batch(Iter, ?BATCH_SIZE), []).
+
+to_list(_Iter, [], Acc) ->
+    lists:append(lists:reverse(Acc));
+to_list(_Iter, {error, _} = E, _Acc) ->
+    E;
+to_list(Iter, Batch, Acc) when is_list(Batch) ->
+    to_list(Iter, next_batch(Iter, ?BATCH_SIZE), [Batch|Acc]).
 
 %% Convenience
 
@@ -9,10 +9,14 @@
         print(i, iter:next())
      end
 
+     local q = db:prepare("(a | b) & ~*c")
+     for i = 1,3 do
+        print(#q:query())
+     end
+
    etc.
 
    TODO:
-    - wrap CNF queries
     - discodb construction (currently read-only)
     - report actual errors coming from discodb
 ]]
@@ -24,6 +28,8 @@ int fileno(void *FILE);
 
 struct ddb;
 struct ddb_cursor;
+struct ddb_prepared;
+struct ddb_query_opts;
 struct ddb_entry {
     const char *data;
     uint32_t length;
@@ -32,10 +38,10 @@ struct ddb_entry {
 struct ddb *ddb_new();
 int ddb_load(struct ddb *db, int fd);
 
-struct ddb_cursor *ddb_keys(struct ddb *db);
-struct ddb_cursor *ddb_values(struct ddb *db);
-struct ddb_cursor *ddb_unique_values(struct ddb *db);
-struct ddb_cursor *ddb_getitem(struct ddb *db, const struct ddb_entry *key);
+struct ddb_cursor *ddb_keys(const struct ddb *db);
+struct ddb_cursor *ddb_values(const struct ddb *db);
+struct ddb_cursor *ddb_unique_values(const struct ddb *db);
+struct ddb_cursor *ddb_getitem(const struct ddb *db, const struct ddb_entry *key);
 
 void ddb_free(struct ddb *db);
 int ddb_error(const struct ddb *db, const char **errstr);
@@ -43,8 +49,16 @@ int ddb_free_cursor(struct ddb_cursor *cur);
 int ddb_notfound(const struct ddb_cursor *c);
 
 const struct ddb_entry *ddb_next(struct ddb_cursor *cur, int *errcode);
+uint32_t ddb_next_batch(struct ddb_cursor *cur, struct ddb_entry *entries,
+    uint32_t max, int *errcode);
 uint64_t ddb_resultset_size(const struct ddb_cursor *cur);
 uint64_t ddb_cursor_count(struct ddb_cursor *c, int *err);
+
+struct ddb_prepared *ddb_prepare(const struct ddb *db, const char *query,
+    uint64_t length);
+struct ddb_cursor *ddb_prepared_query(const struct ddb_prepared *prepared,
+    const struct ddb_query_opts *opts);
+void ddb_prepared_free(struct ddb_prepared *prepared);
 ]]
 
 local Entry = {
@@ -80,6 +94,21 @@ local Cursor = {
          return entry
       end,
 
+      next_batch = function (cursor, max)
+         max = max or 256
+         local err = ffi.new('int[1]')
+         local entries = ffi.new('struct ddb_entry[?]', max)
+         local n = ffi.C.ddb_next_batch(cursor, entries, max, err)
+         if err[0] > 0 then
+            error("ddb_next_batch")
+         end
+         local batch = {}
+         for i = 0, n - 1 do
+            batch[i + 1] = tostring(entries[i])
+         end
+         return batch
+      end,
+
       size = function (cursor)
          return ffi.C.ddb_resultset_size(cursor)
       end,
@@ -103,6 +132,18 @@ local Cursor = {
    end
 }
 
+local Prepared = {
+   __index = {
+      query = function (prepared)
+         local cursor = ffi.C.ddb_prepared_query(prepared, nil)
+         if cursor == nil then
+            error("ddb_prepared_query")
+         end
+         return ffi.gc(cursor, ffi.C.ddb_free_cursor)
+      end
+   }
+}
+
 local DiscoDB = {
    __index = {
       keys = function (db)
@@ -127,12 +168,25 @@ local DiscoDB = {
             return default
          end
          return values
+      end,
+
+      prepare = function (db, query)
+         local prepared = ffi.C.ddb_prepare(db, query, #query)
+         if prepared == nil then
+            error("ddb_prepare")
+         end
+         return ffi.gc(prepared, ffi.C.ddb_prepared_free)
+      end,
+
+      query = function (db, query)
+         return db:prepare(query):query()
       end
    }
 }
 
 ffi.metatype('struct ddb_entry', Entry)
 ffi.metatype('struct ddb_cursor', Cursor)
+ffi.metatype('struct ddb_prepared', Prepared)
 ffi.metatype('struct ddb', DiscoDB)
 
 return {
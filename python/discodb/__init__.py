@@ -1,4 +1,4 @@
-from ._discodb import _DiscoDB, DiscoDBConstructor, DiscoDBError, DiscoDBIter, DiscoDBView
+from ._discodb import _DiscoDB, DiscoDBConstructor, DiscoDBError, DiscoDBIter, DiscoDBView, DiscoDBQuery, DiscoDBCache
 from .query import Q
 from .tools import kvgroup
 
@@ -93,23 +93,54 @@ class DiscoDB(_DiscoDB):
             query = Q.parse(query)
         return DiscoDBItemInquiry(lambda: query.metaquery(self))
 
-    def query(self, query, view=None):
+    def query(self, query, view=None, offset=0, limit=0, threads=0):
         """
         an inquiry over the values of self whose keys satisfy the query.
 
-        The query can be either a :class:`Q` object, or a string.
-        If a string, it is transformed into a :class:`Q` via :meth:`Q.parse`.
+        The query can be either a :class:`Q` object, a string, or a query
+        prepared by :meth:`prepare`. A string is prepared first, in the
+        syntax of :meth:`Q.parse`.
+        The first *offset* results are skipped and at most *limit* results
+        are returned, *limit* being unbounded if 0. Large databases are
+        queried by *threads* threads, if given, in ranges of value IDs.
         """
         if isinstance(query, basestring):
-            query = Q.parse(query)
+            query = self.prepare(query)
         if view == None:
-            l = lambda: super(DiscoDB, self).query(query)
+            l = lambda: super(DiscoDB, self).query(query, offset=offset,
+                                                   limit=limit,
+                                                   threads=threads)
         else:
             if not isinstance(view, DiscoDBView):
                 view = self.make_view(view)
-            l = lambda: super(DiscoDB, self).query(query, view=view)
+            l = lambda: super(DiscoDB, self).query(query, view=view,
+                                                   offset=offset,
+                                                   limit=limit,
+                                                   threads=threads)
         return DiscoDBLazyInquiry(l)
 
+    def facet_counts(self, query, facets, top=0):
+        """
+        a list of (facet, count) pairs, count being the number of values
+        of self that satisfy the query and are values of the key facet.
+
+        The query is given as to :meth:`query`. With *top*, only the
+        *top* facets with the largest counts are listed, largest first.
+        """
+        if isinstance(query, basestring):
+            query = self.prepare(query)
+        return super(DiscoDB, self).facet_counts(query, facets, top=top)
+
+    def min_match(self, keys, min_match, k):
+        """
+        a list of (value, count) pairs for the *k* values of self that are
+        values of the most keys, count being the number of the keys.
+
+        Only values of at least *min_match* keys are listed, largest count
+        first, ties in the order of the values in self.
+        """
+        return super(DiscoDB, self).min_match(keys, min_match, k)
+
     def peek(self, key, default=None):
         """first element of self[key] or else default."""
         try:
@@ -120,7 +151,15 @@ class DiscoDB(_DiscoDB):
     def make_view(self, data):
         return DiscoDBView(self, data)
 
+    def prepare(self, query):
+        """
+        the query string parsed and its keys looked up in self, to be
+        passed to :meth:`query` any number of times.
+        """
+        return DiscoDBQuery(self, query)
+
 __all__ = ['DiscoDB',
+           'DiscoDBCache',
            'DiscoDBConstructor',
            'DiscoDBError',
            'DiscoDBInquiry',
@@ -171,6 +171,22 @@ class Q(object):
                            r'Q.wrap("""\1""".strip())',
                            string.replace('*', '+')) or 'Q([])')
 
+    @classmethod
+    def prefix(cls, prefix):
+        """
+        A Q matching the values of every key that starts with `prefix`.
+        """
+        return cls.wrap(PrefixLiteral(prefix))
+
+    @classmethod
+    def glob(cls, pattern):
+        """
+        A Q matching the values of every key that matches `pattern`,
+        in which ``*`` stands for any run of characters, ``?`` for any
+        single character and ``\\`` escapes the character after it.
+        """
+        return cls.wrap(GlobLiteral(pattern))
+
     @classmethod
     def wrap(cls, proposition):
         """
@@ -232,6 +248,8 @@ class Literal(object):
     """
     A potential key in a discodb (or its negation).
     """
+    type = 0
+
     def __init__(self, term, negated=False):
         self.term    = term
         self.negated = negated
@@ -255,10 +273,11 @@ class Literal(object):
         return type(self)(self.term, negated=not self.negated)
 
     def __eq__(self, other):
-        return self.term == other.term and self.negated == other.negated
+        return self.term == other.term and self.negated == other.negated \
+            and self.type == other.type
 
     def __hash__(self):
-        return hash(self.term) ^ hash(self.negated)
+        return hash(self.term) ^ hash(self.negated) ^ self.type
 
     def __str__(self):
         return '%s%s' % ('~' if self.negated else '', self.term)
@@ -269,6 +288,25 @@ class Literal(object):
     def resolve(self, discodb):
         return Q.wrap(self)
 
+class PrefixLiteral(Literal):
+    """
+    All the keys with a prefix, expanded by the discodb when querying.
+    """
+    type = 2
+
+    def __str__(self):
+        return '%sprefix(%s)' % ('~' if self.negated else '', self.term)
+
+class GlobLiteral(Literal):
+    """
+    All the keys matching a glob pattern, expanded by the discodb when
+    querying.
+    """
+    type = 3
+
+    def __str__(self):
+        return '%sglob(%s)' % ('~' if self.negated else '', self.term)
+
 class MetaLiteral(Literal):
     def __str__(self):
         return '%s+(%s)' % ('~' if self.negated else '', self.term)
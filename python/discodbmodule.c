@@ -48,12 +48,30 @@ static PyMappingMethods DiscoDB_as_mapping = {
 static PyMethodDef DiscoDB_methods[] = {
     {"keys", (PyCFunction)DiscoDB_keys, METH_NOARGS,
      "d.keys() -> an iterator over the keys of d."},
+    {"keys_prefix", (PyCFunction)DiscoDB_keys_prefix, METH_O,
+     "d.keys_prefix(p) -> an iterator over the keys of d that start with p, in order."},
+    {"keys_between", (PyCFunction)DiscoDB_keys_between, METH_VARARGS,
+     "d.keys_between(lo, hi) -> an iterator over the keys k of d with lo <= k < hi, in order.\n"
+     "A bound of None leaves that end of the range open."},
     {"values", (PyCFunction)DiscoDB_values, METH_NOARGS,
      "d.values() -> an iterator over the values of d."},
     {"unique_values", (PyCFunction)DiscoDB_unique_values, METH_NOARGS,
      "d.unique_values() -> an iterator over the unique values of d."},
+    {"getkeys", (PyCFunction)DiscoDB_getkeys, METH_O,
+     "d.getkeys(v) -> an iterator over the keys of d that have the value v."},
     {"query", (PyCFunction)DiscoDB_query, METH_KEYWORDS | METH_VARARGS,
-     "d.query(q) -> an iterator over the values of d whose keys satisfy q."},
+     "d.query(q) -> an iterator over the values of d whose keys satisfy q.\n"
+     "q is a Q object or a DiscoDBQuery prepared for d."},
+    {"facet_counts", (PyCFunction)DiscoDB_facet_counts, METH_KEYWORDS | METH_VARARGS,
+     "d.facet_counts(q, facets[, top]) -> a list of (f, n) pairs, n being the number of\n"
+     "values of d that satisfy q and are values of the key f, for each f in facets.\n"
+     "With top, only the top facets with the largest counts are listed, in order."},
+    {"min_match", (PyCFunction)DiscoDB_min_match, METH_KEYWORDS | METH_VARARGS,
+     "d.min_match(keys, m, k) -> a list of (v, n) pairs for the k values v of d that\n"
+     "are values of the largest numbers n of the keys, each of at least m keys."},
+    {"set_cache", (PyCFunction)DiscoDB_set_cache, METH_O,
+     "d.set_cache(c) -> cache the results of getitem and queries of d in the\n"
+     "DiscoDBCache c, which may be shared with other DiscoDBs, or stop if c is None."},
     {"dumps", (PyCFunction)DiscoDB_dumps, METH_NOARGS,
      "d.dumps() -> a serialization of d."},
     {"dump", (PyCFunction)DiscoDB_dump, METH_O,
@@ -181,6 +199,7 @@ static void
 DiscoDB_dealloc(DiscoDB *self)
 {
     Py_CLEAR(self->obuffer);
+    Py_CLEAR(self->cache);
     free(self->cbuffer);
     ddb_free(self->discodb);
     Py_TYPE(self)->tp_free((PyObject *)self);
@@ -238,6 +257,30 @@ DiscoDB_getitem(register DiscoDB *self, register PyObject *key)
     return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
 }
 
+static PyObject *
+DiscoDB_getkeys(register DiscoDB *self, register PyObject *value)
+{
+    struct ddb_cursor *cursor = NULL;
+    struct ddb_entry ventry;
+
+    if (ddb_string_to_entry(value, &ventry))
+        goto Done;
+
+    cursor = ddb_getkeys(self->discodb, &ventry);
+    if (cursor == NULL)
+        if (ddb_has_error(self->discodb))
+            goto Done;
+
+    if (ddb_notfound(cursor))
+        PyErr_Format(PyExc_KeyError, "%s", PyBytes_AsString(value));
+
+ Done:
+    if (PyErr_Occurred())
+        return NULL;
+
+    return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
+}
+
 static PyObject *
 DiscoDB_keys(DiscoDB *self)
 {
@@ -248,6 +291,45 @@ DiscoDB_keys(DiscoDB *self)
     return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
 }
 
+static PyObject *
+DiscoDB_keys_prefix(DiscoDB *self, PyObject *prefix)
+{
+    struct ddb_cursor *cursor;
+    struct ddb_entry pentry;
+
+    if (ddb_string_to_entry(prefix, &pentry))
+        return NULL;
+
+    cursor = ddb_keys_prefix(self->discodb, &pentry);
+    if (cursor == NULL)
+        if (ddb_has_error(self->discodb))
+            return NULL;
+    return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
+}
+
+static PyObject *
+DiscoDB_keys_between(DiscoDB *self, PyObject *args)
+{
+    PyObject *lo = NULL, *hi = NULL;
+    struct ddb_cursor *cursor;
+    struct ddb_entry loentry, hientry;
+
+    if (!PyArg_ParseTuple(args, "OO", &lo, &hi))
+        return NULL;
+    if (lo != Py_None && ddb_string_to_entry(lo, &loentry))
+        return NULL;
+    if (hi != Py_None && ddb_string_to_entry(hi, &hientry))
+        return NULL;
+
+    cursor = ddb_keys_between(self->discodb,
+                              lo == Py_None ? NULL: &loentry,
+                              hi == Py_None ? NULL: &hientry);
+    if (cursor == NULL)
+        if (ddb_has_error(self->discodb))
+            return NULL;
+    return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
+}
+
 static PyObject *
 DiscoDB_values(DiscoDB *self)
 {
@@ -271,121 +353,215 @@ DiscoDB_unique_values(DiscoDB *self)
 static PyObject *
 DiscoDB_query(register DiscoDB *self, PyObject *args, PyObject *kwds)
 {
-    PyObject
-        *query_ = NULL,
-        *clause = NULL,
-        *clauses = NULL,
-        *literal = NULL,
-        *literals = NULL,
-        *iterclauses = NULL,
-        *iterliterals = NULL,
-        *negated = NULL,
-        *term = NULL,
-        *query = NULL;
+    PyObject *query = NULL;
     DiscoDBView *view = NULL;
-    Py_ssize_t i = 0, j = 0;
-    struct ddb_query_clause *ddb_clauses = NULL;
+    struct ddb_query_opts opts = {0, 0, NULL, 0};
     struct ddb_cursor *cursor = NULL;
+    unsigned long long offset = 0, limit = 0;
+    unsigned int threads = 0;
 
-    static char *kwlist[] = {"query", "view", NULL};
+    static char *kwlist[] = {"query", "view", "offset", "limit", "threads",
+                             NULL};
 
     if (self == NULL)
       goto Done;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O!", kwlist,
-                                     &query_, &DiscoDBViewType, &view))
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O!KKI", kwlist,
+                                     &query, &DiscoDBViewType, &view,
+                                     &offset, &limit, &threads))
       goto Done;
 
-    Py_INCREF(query_);
+    Py_INCREF(query);
     Py_XINCREF(view);
 
-    query = PyObject_CallMethod(query_, "resolve", "O", self);
-    if (query == NULL)
-        goto Done;
+    opts.offset = offset;
+    opts.limit = limit;
+    opts.num_threads = threads;
+    if (view)
+        opts.view = view->view;
+    cursor = ddb_query_object(self, query, &opts);
 
-    clauses = PyObject_GetAttrString(query, "clauses");
-    if (clauses == NULL)
-        goto Done;
+ Done:
+    Py_CLEAR(query);
+    Py_CLEAR(view);
 
-    iterclauses = PyObject_GetIter(clauses);
-    if (iterclauses == NULL)
+    if (PyErr_Occurred()) {
+        ddb_cursor_dealloc(cursor);
+        return NULL;
+    }
+
+    return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
+}
+
+static PyObject *
+DiscoDB_facet_counts(register DiscoDB *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *query = NULL,
+             *facets = NULL,
+             *result = NULL;
+    struct ddb_query_opts opts = {0, 0, NULL, 0};
+    struct ddb_cursor *cursor = NULL;
+    struct ddb_entry *entries = NULL;
+    uint64_t *counts = NULL;
+    uint32_t *top = NULL;
+    unsigned int k = 0;
+    Py_ssize_t i, n;
+    int num_top;
+
+    static char *kwlist[] = {"query", "facets", "top", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|I", kwlist,
+                                     &query, &facets, &k))
+        return NULL;
+
+    if (!(facets = PySequence_Fast(facets, "facets must be a sequence")))
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(facets);
+
+    entries = calloc(n + 1, sizeof(struct ddb_entry));
+    counts = calloc(n + 1, sizeof(uint64_t));
+    if (k)
+        top = calloc(n + 1, sizeof(uint32_t));
+    if (!entries || !counts || (k && !top)) {
+        PyErr_NoMemory();
         goto Done;
+    }
+    for (i = 0; i < n; i++)
+        if (ddb_string_to_entry(PySequence_Fast_GET_ITEM(facets, i),
+                                &entries[i]))
+            goto Done;
 
-    if ((i = PyObject_Length(clauses)) < 0)
+    if (!(cursor = ddb_query_object(self, query, &opts)))
+        goto Done;
+    if ((num_top = ddb_facet_counts(cursor, entries, n, counts, top, k)) == -1) {
+        ddb_has_error(self->discodb);
         goto Done;
-    ddb_clauses = ddb_query_clause_alloc(i);
+    }
 
-    for (i = 0; (clause = PyIter_Next(iterclauses)); i++) {
-        literals = PyObject_GetAttrString(clause, "literals");
-        if (literals == NULL)
+    /* the k largest counts, or all of them in the order of facets */
+    if (k)
+        n = num_top;
+    if (!(result = PyList_New(n)))
+        goto Done;
+    for (i = 0; i < n; i++) {
+        Py_ssize_t j = k ? top[i] : i;
+        PyObject *pair = Py_BuildValue("OK",
+                                       PySequence_Fast_GET_ITEM(facets, j),
+                                       (unsigned long long)counts[j]);
+        if (!pair) {
+            Py_CLEAR(result);
             goto Done;
+        }
+        PyList_SET_ITEM(result, i, pair);
+    }
 
-        iterliterals = PyObject_GetIter(literals);
-        if (iterliterals == NULL)
-            goto Done;
+ Done:
+    ddb_cursor_dealloc(cursor);
+    free(entries);
+    free(counts);
+    free(top);
+    Py_CLEAR(facets);
+    return result;
+}
 
-        if ((j = PyObject_Length(literals)) < 0)
-            goto Done;
-        ddb_clauses[i].num_terms = j;
-        ddb_clauses[i].terms     = ddb_query_term_alloc(j);
 
-        for (j = 0; (literal = PyIter_Next(iterliterals)); j++) {
-            negated = PyObject_GetAttrString(literal, "negated");
-            if (negated == NULL)
-                goto Done;
 
-            term = PyObject_GetAttrString(literal, "term");
-            if (term == NULL)
-                goto Done;
+static PyObject *
+DiscoDB_min_match(register DiscoDB *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *keys = NULL,
+             *result = NULL;
+    struct ddb_query_term *terms = NULL;
+    struct ddb_match *matches = NULL;
+    uint32_t *ids = NULL;
+    struct ddb_cursor *cursor = NULL;
+    const struct ddb_entry *next;
+    unsigned int min_match = 0, k = 0;
+    Py_ssize_t i, n;
+    int num_matches, errcode;
 
-            ddb_clauses[i].terms[j].nnot = PyObject_IsTrue(negated);
+    static char *kwlist[] = {"keys", "min_match", "k", NULL};
 
-            if (ddb_string_to_entry(term, &ddb_clauses[i].terms[j].key))
-                goto Done;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OII", kwlist,
+                                     &keys, &min_match, &k))
+        return NULL;
 
-            Py_CLEAR(literal);
-            Py_CLEAR(negated);
-            Py_CLEAR(term);
-        }
+    if (!(keys = PySequence_Fast(keys, "keys must be a sequence")))
+        return NULL;
+    n = PySequence_Fast_GET_SIZE(keys);
 
-        Py_CLEAR(clause);
-        Py_CLEAR(literals);
-        Py_CLEAR(iterliterals);
+    if (!(terms = ddb_query_term_alloc(n + 1)))
+        goto Done;
+    matches = calloc(k + 1, sizeof(struct ddb_match));
+    ids = calloc(k + 1, sizeof(uint32_t));
+    if (!matches || !ids) {
+        PyErr_NoMemory();
+        goto Done;
     }
+    for (i = 0; i < n; i++)
+        if (ddb_string_to_entry(PySequence_Fast_GET_ITEM(keys, i),
+                                &terms[i].key))
+            goto Done;
 
-    if (view)
-        cursor = ddb_query_view(self->discodb, ddb_clauses, i, view->view);
-    else
-        cursor = ddb_query(self->discodb, ddb_clauses, i);
+    num_matches = ddb_query_min_match(self->discodb, terms, n, min_match,
+                                      matches, k);
+    if (num_matches == -1) {
+        ddb_has_error(self->discodb);
+        goto Done;
+    }
+    for (i = 0; i < num_matches; i++)
+        ids[i] = matches[i].id;
+    if (!(cursor = ddb_values_by_id(self->discodb, ids, num_matches))) {
+        ddb_has_error(self->discodb);
+        goto Done;
+    }
 
-    if (cursor == NULL)
-        if (ddb_has_error(self->discodb))
+    if (!(result = PyList_New(num_matches)))
+        goto Done;
+    for (i = 0; i < num_matches; i++) {
+        PyObject *pair;
+        if (!(next = ddb_next(cursor, &errcode))) {
+            PyErr_NoMemory();
+            Py_CLEAR(result);
+            goto Done;
+        }
+        if (!(pair = Py_BuildValue("s#I", next->data, next->length,
+                                   matches[i].count))) {
+            Py_CLEAR(result);
             goto Done;
+        }
+        PyList_SET_ITEM(result, i, pair);
+    }
 
  Done:
-    Py_CLEAR(clause);
-    Py_CLEAR(clauses);
-    Py_CLEAR(literal);
-    Py_CLEAR(literals);
-    Py_CLEAR(iterclauses);
-    Py_CLEAR(iterliterals);
-    Py_CLEAR(negated);
-    Py_CLEAR(term);
-    Py_CLEAR(query_);
-    Py_CLEAR(query);
-    Py_CLEAR(view);
-    ddb_query_clause_dealloc(ddb_clauses, i);
+    ddb_cursor_dealloc(cursor);
+    free(terms);
+    free(matches);
+    free(ids);
+    Py_CLEAR(keys);
+    return result;
+}
 
-    if (PyErr_Occurred()) {
-        ddb_cursor_dealloc(cursor);
+
+
+static PyObject *
+DiscoDB_set_cache(register DiscoDB *self, PyObject *cache)
+{
+    if (cache == Py_None)
+        ddb_set_cache(self->discodb, NULL);
+    else if (PyObject_TypeCheck(cache, &DiscoDBCacheType))
+        ddb_set_cache(self->discodb, ((DiscoDBCache *)cache)->cache);
+    else {
+        PyErr_SetString(PyExc_TypeError, "cache must be a DiscoDBCache or None");
         return NULL;
     }
-
-    return DiscoDBIter_new(&DiscoDBIterType, self, cursor);
+    /* the cache must outlive the db that uses it */
+    Py_INCREF(cache);
+    Py_CLEAR(self->cache);
+    self->cache = cache;
+    Py_RETURN_NONE;
 }
 
-
-
 /* Serialization / Deserialization Informal Protocol */
 
 static PyObject *
@@ -532,6 +708,18 @@ init_discodb(void)
     PyModule_AddObject(module, "DiscoDBView",
                        (PyObject *)&DiscoDBViewType);
 
+    if (PyType_Ready(&DiscoDBQueryType) < 0)
+      return;
+    Py_INCREF(&DiscoDBQueryType);
+    PyModule_AddObject(module, "DiscoDBQuery",
+                       (PyObject *)&DiscoDBQueryType);
+
+    if (PyType_Ready(&DiscoDBCacheType) < 0)
+      return;
+    Py_INCREF(&DiscoDBCacheType);
+    PyModule_AddObject(module, "DiscoDBCache",
+                       (PyObject *)&DiscoDBCacheType);
+
     DiscoDBError = PyErr_NewException("discodb.DiscoDBError", NULL, NULL);
     Py_INCREF(DiscoDBError);
     PyModule_AddObject(module, "DiscoDBError", DiscoDBError);
@@ -716,23 +904,43 @@ DiscoDBConstructor_finalize(DiscoDBConstructor *self, PyObject *args, PyObject *
     uint64_t n,
       flags = 0,
       disable_compression = 0,
-      unique_items = 0;
+      unique_items = 0,
+      value_index = 0,
+      inverted = 0,
+      sorted_keys = 0,
+      skips = 0;
 
     static char *kwlist[] = {"disable_compression",
-                             "unique_items", NULL};
+                             "unique_items",
+                             "value_index",
+                             "inverted",
+                             "sorted_keys",
+                             "skips", NULL};
 
     if (discodb == NULL)
       goto Done;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|II", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IIIIII", kwlist,
                                      &disable_compression,
-                                     &unique_items))
+                                     &unique_items,
+                                     &value_index,
+                                     &inverted,
+                                     &sorted_keys,
+                                     &skips))
       goto Done;
 
     if (disable_compression)
       flags |= DDB_OPT_DISABLE_COMPRESSION;
     if (unique_items)
       flags |= DDB_OPT_UNIQUE_ITEMS;
+    if (value_index)
+      flags |= DDB_OPT_VALUE_INDEX;
+    if (inverted)
+      flags |= DDB_OPT_INVERTED;
+    if (sorted_keys)
+      flags |= DDB_OPT_SORTED_KEYS;
+    if (skips)
+      flags |= DDB_OPT_SKIPS;
 
     discodb->obuffer = NULL;
     discodb->cbuffer = ddb_cons_finalize(self->ddb_cons, &n, flags);
@@ -765,6 +973,8 @@ static PyMethodDef DiscoDBIter_methods[] = {
      "i.count() -> count the remaining entries in the iterator."},
     {"size", (PyCFunction)DiscoDBIter_size, METH_NOARGS,
      "i.size() -> the size of the underlying cursor."},
+    {"batch", (PyCFunction)DiscoDBIter_batch, METH_VARARGS,
+     "i.batch([n]) -> a list of at most n next entries in the iterator."},
     {NULL}                                   /* Sentinel          */
 };
 
@@ -836,6 +1046,56 @@ DiscoDBIter_size(DiscoDBIter *self)
     return PyInt_FromSsize_t(ddb_resultset_size(self->cursor));
 }
 
+static PyObject *
+DiscoDBIter_batch(DiscoDBIter *self, PyObject *args)
+{
+    PyObject *list = NULL;
+    struct ddb_entry *entries = NULL;
+    Py_ssize_t max = 256;
+    uint32_t i, n;
+    int errcode;
+
+    if (!PyArg_ParseTuple(args, "|n", &max))
+        goto Done;
+
+    if (max < 0 || max > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "Invalid batch size");
+        goto Done;
+    }
+
+    entries = (struct ddb_entry *)malloc((max ? max : 1) * sizeof(struct ddb_entry));
+    if (entries == NULL) {
+        PyErr_NoMemory();
+        goto Done;
+    }
+
+    n = ddb_next_batch(self->cursor, entries, max, &errcode);
+    if (errcode) {
+        ddb_cursor_error(errcode);
+        goto Done;
+    }
+
+    list = PyList_New(n);
+    if (list == NULL)
+        goto Done;
+
+    for (i = 0; i < n; i++) {
+        PyObject *item = PyString_FromStringAndSize(entries[i].data, entries[i].length);
+        if (item == NULL)
+            goto Done;
+        PyList_SET_ITEM(list, i, item);
+    }
+
+ Done:
+    free(entries);
+
+    if (PyErr_Occurred()) {
+        Py_CLEAR(list);
+        return NULL;
+    }
+    return list;
+}
+
 static PyObject *
 DiscoDBIter_iternext(DiscoDBIter *self)
 {
@@ -843,7 +1103,7 @@ DiscoDBIter_iternext(DiscoDBIter *self)
     const struct ddb_entry *next = ddb_next(self->cursor, &errcode);
 
     if (errcode)
-        return PyErr_NoMemory();
+        return ddb_cursor_error(errcode);
 
     if (next == NULL)
         return NULL;
@@ -962,6 +1222,181 @@ static Py_ssize_t DiscoDBView_len(DiscoDBView *self)
     return ddb_view_size(self->view);
 }
 
+/* DiscoDB Query Type */
+
+static PyMethodDef DiscoDBQuery_methods[] = {
+    {NULL}                                   /* Sentinel          */
+};
+
+static PyTypeObject DiscoDBQueryType = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "DiscoDBQuery",                          /* tp_name           */
+    sizeof(DiscoDBQuery),                    /* tp_basicsize      */
+    0,                                       /* tp_itemsize       */
+    (destructor)DiscoDBQuery_dealloc,        /* tp_dealloc        */
+    0,                                       /* tp_print          */
+    0,                                       /* tp_getattr        */
+    0,                                       /* tp_setattr        */
+    0,                                       /* tp_compare        */
+    0,                                       /* tp_repr           */
+    0,                                       /* tp_as_number      */
+    0,                                       /* tp_as_sequence    */
+    0,                                       /* tp_as_mapping     */
+    0,                                       /* tp_hash           */
+    0,                                       /* tp_call           */
+    0,                                       /* tp_str            */
+    PyObject_GenericGetAttr,                 /* tp_getattro       */
+    0,                                       /* tp_setattro       */
+    0,                                       /* tp_as_buffer      */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_BASETYPE,                     /* tp_flags          */
+    "DiscoDBQuery(d, s) -> the query string s parsed, with its keys\n"
+    "looked up in d.",                       /* tp_doc            */
+    0,                                       /* tp_traverse       */
+    0,                                       /* tp_clear          */
+    0,                                       /* tp_richcompare    */
+    0,                                       /* tp_weaklistoffset */
+    0,                                       /* tp_iter           */
+    0,                                       /* tp_iternext       */
+    DiscoDBQuery_methods,                    /* tp_methods        */
+    0,                                       /* tp_members        */
+    0,                                       /* tp_getset         */
+    0,                                       /* tp_base           */
+    0,                                       /* tp_dict           */
+    0,                                       /* tp_descr_get      */
+    0,                                       /* tp_descr_set      */
+    0,                                       /* tp_dictoffset     */
+    0,                                       /* tp_init           */
+    0,                                       /* tp_alloc          */
+    DiscoDBQuery_new,                        /* tp_new            */
+    0,                                       /* tp_free           */
+};
+
+static PyObject *
+DiscoDBQuery_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    DiscoDB *ddb = NULL;
+    const char *query = NULL;
+    Py_ssize_t length = 0;
+    DiscoDBQuery *self = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!s#", &DiscoDBType, &ddb, &query, &length))
+        return NULL;
+
+    if (!(self = (DiscoDBQuery *)type->tp_alloc(type, 0)))
+        return NULL;
+
+    /* the prepared query refers to the db */
+    Py_INCREF(ddb);
+    self->owner = ddb;
+    if (!(self->prepared = ddb_prepare(ddb->discodb, query, length))) {
+        ddb_has_error(ddb->discodb);
+        Py_CLEAR(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static void
+DiscoDBQuery_dealloc(DiscoDBQuery *self)
+{
+    ddb_prepared_free(self->prepared);
+    Py_CLEAR(self->owner);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* DiscoDB Cache Type */
+
+static PyMethodDef DiscoDBCache_methods[] = {
+    {"stats", (PyCFunction)DiscoDBCache_stats, METH_NOARGS,
+     "c.stats() -> a dict of the hits, misses, evictions, entries and size of c."},
+    {NULL}                                   /* Sentinel          */
+};
+
+static PyTypeObject DiscoDBCacheType = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "DiscoDBCache",                          /* tp_name           */
+    sizeof(DiscoDBCache),                    /* tp_basicsize      */
+    0,                                       /* tp_itemsize       */
+    (destructor)DiscoDBCache_dealloc,        /* tp_dealloc        */
+    0,                                       /* tp_print          */
+    0,                                       /* tp_getattr        */
+    0,                                       /* tp_setattr        */
+    0,                                       /* tp_compare        */
+    0,                                       /* tp_repr           */
+    0,                                       /* tp_as_number      */
+    0,                                       /* tp_as_sequence    */
+    0,                                       /* tp_as_mapping     */
+    0,                                       /* tp_hash           */
+    0,                                       /* tp_call           */
+    0,                                       /* tp_str            */
+    PyObject_GenericGetAttr,                 /* tp_getattro       */
+    0,                                       /* tp_setattro       */
+    0,                                       /* tp_as_buffer      */
+    Py_TPFLAGS_DEFAULT |
+    Py_TPFLAGS_BASETYPE,                     /* tp_flags          */
+    "DiscoDBCache(n) -> a cache of query results taking at most n bytes.",
+                                             /* tp_doc            */
+    0,                                       /* tp_traverse       */
+    0,                                       /* tp_clear          */
+    0,                                       /* tp_richcompare    */
+    0,                                       /* tp_weaklistoffset */
+    0,                                       /* tp_iter           */
+    0,                                       /* tp_iternext       */
+    DiscoDBCache_methods,                    /* tp_methods        */
+    0,                                       /* tp_members        */
+    0,                                       /* tp_getset         */
+    0,                                       /* tp_base           */
+    0,                                       /* tp_dict           */
+    0,                                       /* tp_descr_get      */
+    0,                                       /* tp_descr_set      */
+    0,                                       /* tp_dictoffset     */
+    0,                                       /* tp_init           */
+    0,                                       /* tp_alloc          */
+    DiscoDBCache_new,                        /* tp_new            */
+    0,                                       /* tp_free           */
+};
+
+static PyObject *
+DiscoDBCache_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    unsigned long long max_size = 0;
+    DiscoDBCache *self = NULL;
+
+    if (!PyArg_ParseTuple(args, "K", &max_size))
+        return NULL;
+
+    if (!(self = (DiscoDBCache *)type->tp_alloc(type, 0)))
+        return NULL;
+
+    if (!(self->cache = ddb_cache_new(max_size))) {
+        Py_CLEAR(self);
+        return PyErr_NoMemory();
+    }
+    return (PyObject *)self;
+}
+
+static void
+DiscoDBCache_dealloc(DiscoDBCache *self)
+{
+    ddb_cache_free(self->cache);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+DiscoDBCache_stats(DiscoDBCache *self)
+{
+    struct ddb_cache_stats stats;
+
+    ddb_cache_stats(self->cache, &stats);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+                         "hits", (unsigned long long)stats.hits,
+                         "misses", (unsigned long long)stats.misses,
+                         "evictions", (unsigned long long)stats.evictions,
+                         "num_entries", (unsigned long long)stats.num_entries,
+                         "size", (unsigned long long)stats.size);
+}
+
 /* ddb helpers */
 
 static struct ddb *
@@ -1017,14 +1452,166 @@ ddb_cursor_dealloc(struct ddb_cursor *cursor)
 static void
 ddb_query_clause_dealloc(struct ddb_query_clause *clauses, uint32_t num_clauses)
 {
-    int i;
+    int i, j;
     for (i = 0; i < num_clauses; i++)
-        if (clauses[i].terms)
+        if (clauses[i].terms) {
+            for (j = 0; j < clauses[i].num_terms; j++)
+                if (clauses[i].terms[j].type == DDB_TERM_META)
+                    ddb_query_clause_dealloc(
+                        (struct ddb_query_clause *)clauses[i].terms[j].clauses,
+                        clauses[i].terms[j].num_clauses);
             free(clauses[i].terms);
+        }
     if (clauses)
         free(clauses);
 }
 
+/* Converts the clauses of a Q. The term of a meta literal is a Q
+   itself, which becomes the sub-query of a meta term, so that the db
+   evaluates it without going through Python. */
+static struct ddb_query_clause *
+ddb_query_from_q(PyObject *query, uint32_t *num_clauses)
+{
+    PyObject
+        *clause = NULL,
+        *clauses = NULL,
+        *literal = NULL,
+        *literals = NULL,
+        *iterclauses = NULL,
+        *iterliterals = NULL,
+        *negated = NULL,
+        *term = NULL,
+        *type = NULL;
+    Py_ssize_t i = 0, j = 0, n = 0;
+    struct ddb_query_clause *ddb_clauses = NULL;
+
+    *num_clauses = 0;
+
+    clauses = PyObject_GetAttrString(query, "clauses");
+    if (clauses == NULL)
+        goto Done;
+
+    iterclauses = PyObject_GetIter(clauses);
+    if (iterclauses == NULL)
+        goto Done;
+
+    if ((n = PyObject_Length(clauses)) < 0)
+        goto Done;
+    ddb_clauses = ddb_query_clause_alloc(n + 1);
+    if (ddb_clauses == NULL)
+        goto Done;
+    *num_clauses = n;
+
+    for (i = 0; (clause = PyIter_Next(iterclauses)); i++) {
+        literals = PyObject_GetAttrString(clause, "literals");
+        if (literals == NULL)
+            goto Done;
+
+        iterliterals = PyObject_GetIter(literals);
+        if (iterliterals == NULL)
+            goto Done;
+
+        if ((j = PyObject_Length(literals)) < 0)
+            goto Done;
+        ddb_clauses[i].terms = ddb_query_term_alloc(j + 1);
+        if (ddb_clauses[i].terms == NULL)
+            goto Done;
+        ddb_clauses[i].num_terms = j;
+
+        for (j = 0; (literal = PyIter_Next(iterliterals)); j++) {
+            struct ddb_query_term *t = &ddb_clauses[i].terms[j];
+
+            negated = PyObject_GetAttrString(literal, "negated");
+            if (negated == NULL)
+                goto Done;
+
+            term = PyObject_GetAttrString(literal, "term");
+            if (term == NULL)
+                goto Done;
+
+            t->nnot = PyObject_IsTrue(negated);
+
+            if (PyObject_HasAttrString(term, "clauses")) {
+                t->type = DDB_TERM_META;
+                t->clauses = ddb_query_from_q(term, &t->num_clauses);
+                if (t->clauses == NULL)
+                    goto Done;
+            } else {
+                if (ddb_string_to_entry(term, &t->key))
+                    goto Done;
+
+                /* prefix and glob literals are expanded by the query */
+                if (PyObject_HasAttrString(literal, "type")) {
+                    type = PyObject_GetAttrString(literal, "type");
+                    if (type == NULL)
+                        goto Done;
+                    t->type = PyLong_AsLong(type);
+                    if (PyErr_Occurred())
+                        goto Done;
+                }
+            }
+
+            Py_CLEAR(literal);
+            Py_CLEAR(negated);
+            Py_CLEAR(term);
+            Py_CLEAR(type);
+        }
+
+        Py_CLEAR(clause);
+        Py_CLEAR(literals);
+        Py_CLEAR(iterliterals);
+    }
+
+ Done:
+    Py_CLEAR(clause);
+    Py_CLEAR(clauses);
+    Py_CLEAR(literal);
+    Py_CLEAR(literals);
+    Py_CLEAR(iterclauses);
+    Py_CLEAR(iterliterals);
+    Py_CLEAR(negated);
+    Py_CLEAR(term);
+    Py_CLEAR(type);
+
+    if (PyErr_Occurred()) {
+        ddb_query_clause_dealloc(ddb_clauses, *num_clauses);
+        *num_clauses = 0;
+        return NULL;
+    }
+    return ddb_clauses;
+}
+
+/* Runs a Q object or a DiscoDBQuery. Returns NULL with an exception set
+   if the query fails. */
+static struct ddb_cursor *
+ddb_query_object(DiscoDB *discodb, PyObject *query,
+                 const struct ddb_query_opts *opts)
+{
+    uint32_t num_clauses = 0;
+    struct ddb_query_clause *ddb_clauses = NULL;
+    struct ddb_cursor *cursor = NULL;
+
+    if (PyObject_TypeCheck(query, &DiscoDBQueryType)) {
+        DiscoDBQuery *prepared = (DiscoDBQuery *)query;
+        if (prepared->owner != discodb) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Query was prepared for another DiscoDB");
+            return NULL;
+        }
+        cursor = ddb_prepared_query(prepared->prepared, opts);
+    } else {
+        ddb_clauses = ddb_query_from_q(query, &num_clauses);
+        if (ddb_clauses == NULL)
+            return NULL;
+        cursor = ddb_query_with_opts(discodb->discodb, ddb_clauses,
+                                     num_clauses, opts);
+        ddb_query_clause_dealloc(ddb_clauses, num_clauses);
+    }
+    if (cursor == NULL)
+        ddb_has_error(discodb->discodb);
+    return cursor;
+}
+
 static int
 ddb_has_error(struct ddb *discodb)
 {
@@ -1035,6 +1622,13 @@ ddb_has_error(struct ddb *discodb)
     return errcode;
 }
 
+static PyObject *
+ddb_cursor_error(int errcode)
+{
+    PyErr_SetString(DiscoDBError, ddb_strerror(errcode));
+    return NULL;
+}
+
 static int
 ddb_string_to_entry(PyObject *str, struct ddb_entry *e)
 {
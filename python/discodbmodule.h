@@ -5,6 +5,7 @@ typedef struct {
     PyObject   *obuffer;
     char       *cbuffer;
     struct ddb *discodb;
+    PyObject   *cache;
 } DiscoDB;
 
 typedef struct {
@@ -24,6 +25,17 @@ typedef struct {
     struct ddb_view *view;
 } DiscoDBView;
 
+typedef struct {
+    PyObject_HEAD
+    DiscoDB             *owner;
+    struct ddb_prepared *prepared;
+} DiscoDBQuery;
+
+typedef struct {
+    PyObject_HEAD
+    struct ddb_cache *cache;
+} DiscoDBCache;
+
 /* General Object Protocol */
 
 static PyObject * DiscoDB_new     (PyTypeObject *, PyObject *, PyObject *);
@@ -33,10 +45,16 @@ static void       DiscoDB_dealloc (DiscoDB *);
 
 static int        DiscoDB_contains     (DiscoDB *,      PyObject *);
 static PyObject * DiscoDB_getitem      (DiscoDB *,      PyObject *);
+static PyObject * DiscoDB_getkeys      (DiscoDB *,      PyObject *);
 static PyObject * DiscoDB_keys         (DiscoDB *);
+static PyObject * DiscoDB_keys_prefix  (DiscoDB *,      PyObject *);
+static PyObject * DiscoDB_keys_between (DiscoDB *,      PyObject *);
 static PyObject * DiscoDB_values       (DiscoDB *);
 static PyObject * DiscoDB_unique_values(DiscoDB *);
 static PyObject * DiscoDB_query        (DiscoDB *, PyObject *, PyObject *);
+static PyObject * DiscoDB_facet_counts (DiscoDB *, PyObject *, PyObject *);
+static PyObject * DiscoDB_min_match    (DiscoDB *, PyObject *, PyObject *);
+static PyObject * DiscoDB_set_cache    (DiscoDB *, PyObject *);
 
 /* Serialization / Deserialization Informal Protocol */
 
@@ -62,6 +80,7 @@ static PyObject * DiscoDBIter_new      (PyTypeObject *, DiscoDB *, struct ddb_cu
 static void       DiscoDBIter_dealloc  (DiscoDBIter *);
 static PyObject * DiscoDBIter_count    (DiscoDBIter *);
 static PyObject * DiscoDBIter_size     (DiscoDBIter *);
+static PyObject * DiscoDBIter_batch    (DiscoDBIter *, PyObject *);
 static PyObject * DiscoDBIter_iternext (DiscoDBIter *);
 
 /* DiscoDB View Types */
@@ -72,6 +91,21 @@ static PyObject * DiscoDBView_new     (PyTypeObject *, PyObject *, PyObject *);
 static void       DiscoDBView_dealloc (DiscoDBView *);
 static Py_ssize_t DiscoDBView_len     (DiscoDBView *);
 
+/* DiscoDB Query Types */
+
+static PyTypeObject DiscoDBQueryType;
+
+static PyObject * DiscoDBQuery_new     (PyTypeObject *, PyObject *, PyObject *);
+static void       DiscoDBQuery_dealloc (DiscoDBQuery *);
+
+/* DiscoDB Cache Types */
+
+static PyTypeObject DiscoDBCacheType;
+
+static PyObject * DiscoDBCache_new     (PyTypeObject *, PyObject *, PyObject *);
+static void       DiscoDBCache_dealloc (DiscoDBCache *);
+static PyObject * DiscoDBCache_stats   (DiscoDBCache *);
+
 /* ddb helpers */
 
 static struct ddb              *ddb_alloc               (void);
@@ -81,7 +115,10 @@ static struct ddb_query_term   *ddb_query_term_alloc    (size_t);
 static        void              ddb_cons_dealloc        (struct ddb_cons *);
 static        void              ddb_cursor_dealloc      (struct ddb_cursor *);
 static        void              ddb_query_clause_dealloc(struct ddb_query_clause *, uint32_t);
+static struct ddb_query_clause *ddb_query_from_q        (PyObject *, uint32_t *);
+static struct ddb_cursor       *ddb_query_object        (DiscoDB *, PyObject *, const struct ddb_query_opts *);
 static        int               ddb_has_error           (struct ddb *);
+static        PyObject         *ddb_cursor_error        (int);
 static        int               ddb_string_to_entry     (PyObject *, struct ddb_entry *);
 
 #define DiscoDB_CLEAR(op) do { free(op); op = NULL; } while(0)
@@ -4,7 +4,7 @@ from distutils.core import setup, Extension
 discodb_module = Extension('discodb._discodb',
                            sources=['discodbmodule.c'] + glob.glob('../src/*.c'),
                            include_dirs=['../src'],
-                           libraries=['cmph'])
+                           libraries=['cmph', 'pthread'])
 
 setup(name='discodb',
       version='0.2',
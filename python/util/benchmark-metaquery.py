@@ -0,0 +1,45 @@
+from discodb import DiscoDB, Q
+from time import time
+from random import randint, seed
+from csv import DictWriter
+
+NUM_KEYS = int(1e5)
+FANOUT = 20
+
+def items():
+    seed(1)
+    for k in xrange(NUM_KEYS):
+        yield str(k), [str(randint(0, NUM_KEYS - 1)) for i in xrange(FANOUT)]
+
+def timed(f, n=5):
+    def run():
+        s = time()
+        f()
+        return time() - s
+    return min(run() for i in range(n)) * 1000
+
+def queries():
+    for s in ('*1', '*1 | *2', '**1', '**1 | *2', '*(1 | 2) & ~*3', '***1'):
+        yield s, Q.parse(s)
+
+def test(db):
+    for s, q in queries():
+        if set(db.query(q)) != set(db.query(q.resolve(db))):
+            raise Exception("no match: %s" % s)
+
+def bmark(db):
+    for s, q in queries():
+        yield {"query": s,
+               "results": len(db.query(q)),
+               "resolve": timed(lambda: sum(1 for _ in db.query(q.resolve(db)))),
+               "native": timed(lambda: sum(1 for _ in db.query(q)))}
+
+db = DiscoDB(items())
+test(db)
+print "tests pass"
+rows = list(bmark(db))
+f = open('bmark-metaquery.csv', 'w')
+csv = DictWriter(f, ["query", "results", "resolve", "native"])
+csv.writeheader()
+csv.writerows(rows)
+f.close()
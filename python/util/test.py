@@ -2,7 +2,7 @@ import doctest, unittest
 from random import randint
 
 from discodb import DiscoDB, Q
-from discodb import DiscoDBConstructor
+from discodb import DiscoDBCache, DiscoDBConstructor, DiscoDBError
 from discodb import query
 from discodb import tools
 
@@ -90,6 +90,15 @@ class TestMappingProtocol(unittest.TestCase):
     def test_unique_values(self):
         len(list(self.discodb.unique_values()))
 
+    def test_batch(self):
+        values, iterator = [], iter(self.discodb.values())
+        batch = iterator.batch(100)
+        while batch:
+            self.assert_(len(batch) <= 100)
+            values.extend(batch)
+            batch = iterator.batch(100)
+        self.assertEquals(values, list(self.discodb.values()))
+
     def test_peek(self):
         self.assertNotEquals(self.discodb.peek('0'), None)
         self.assertEquals(self.discodb.peek('X'), None)
@@ -155,6 +164,61 @@ class TestUniqueItems(TestMappingProtocol, TestSerializationProtocol):
     def test_uniq(self):
         self.assertEqual(list(self.discodb['0']), ['1', '2'])
 
+class TestValueIndex(TestMappingProtocol, TestSerializationProtocol):
+    def setUp(self):
+        self.discodb = DiscoDB(k_vs_iter(self.numkeys), value_index=True)
+
+    def test_view(self):
+        view = self.discodb.make_view(['1', '5', 'nonvalue'])
+        self.assertEqual(len(view), 2)
+        self.assertEqual(sorted(self.discodb.query(Q.parse('0'), view=view)),
+                         sorted(v for v in self.discodb['0'] if v in ('1', '5')))
+
+class TestInverted(TestMappingProtocol, TestSerializationProtocol):
+    def setUp(self):
+        self.discodb = DiscoDB(k_vs_iter(self.numkeys), inverted=True)
+
+    def test_getkeys(self):
+        for value in ('0', '5', '42'):
+            self.assertEqual(sorted(self.discodb.getkeys(value)),
+                             sorted(k for k in self.discodb.keys()
+                                    if value in list(self.discodb[k])))
+        self.assertRaises(KeyError, self.discodb.getkeys, 'nonvalue')
+
+class TestSkips(TestMappingProtocol, TestSerializationProtocol):
+    def setUp(self):
+        self.discodb = DiscoDB(k_vs_iter(self.numkeys), skips=True)
+        self.discodb_p = DiscoDB(self.discodb)
+
+    def test_skips(self):
+        for s in ('0 & 1', '5 & 10 & ~15', '(1 | 2) & 3 & 4'):
+            self.assertEqual(list(self.discodb.query(Q.parse(s))),
+                             list(self.discodb_p.query(Q.parse(s))))
+        self.assertTrue(len(self.discodb.dumps()) >
+                        len(self.discodb_p.dumps()))
+
+class TestSortedKeys(TestMappingProtocol, TestSerializationProtocol):
+    def setUp(self):
+        self.discodb = DiscoDB(k_vs_iter(self.numkeys), sorted_keys=True)
+
+    def test_keys(self):
+        self.assertEqual(list(self.discodb.keys()), sorted(self.discodb.keys()))
+
+    def test_prefix(self):
+        self.assertEqual(list(self.discodb.keys_prefix('12')),
+                         sorted(k for k in self.discodb.keys()
+                                if k.startswith('12')))
+        self.assertEqual(list(self.discodb.keys_prefix('x')), [])
+
+    def test_between(self):
+        keys = sorted(self.discodb.keys())
+        self.assertEqual(list(self.discodb.keys_between('3', '45')),
+                         [k for k in keys if '3' <= k < '45'])
+        self.assertEqual(list(self.discodb.keys_between(None, '2')),
+                         [k for k in keys if k < '2'])
+        self.assertEqual(list(self.discodb.keys_between('9', None)),
+                         [k for k in keys if k >= '9'])
+
 class TestQuery(unittest.TestCase):
     def setUp(self):
         self.discodb = DiscoDB(
@@ -203,6 +267,15 @@ class TestQuery(unittest.TestCase):
         self.assertEquals(set(self.q('alice|bob|carol')), set(['blue', 'red']))
         self.assertEquals(set(self.q('alice&bob&carol')), set())
 
+    def test_query_offset_limit(self):
+        q = Q.parse('alice | bob')
+        results = list(self.discodb.query(q))
+        self.assertEquals(list(self.discodb.query(q, limit=1)), results[:1])
+        self.assertEquals(list(self.discodb.query(q, offset=1)), results[1:])
+        self.assertEquals(list(self.discodb.query(q, offset=1, limit=1)),
+                          results[1:2])
+        self.assertEquals(list(self.discodb.query(q, offset=2)), [])
+
     def test_query_len_nonkey(self):
         self.assertEquals(len(self.q('nonkey')), 0)
         self.assertEquals(len(self.q('~nonkey')), 2)
@@ -215,6 +288,172 @@ class TestQuery(unittest.TestCase):
         self.assertEquals(set(self.q('nonkey & alice')), set())
         self.assertEquals(set(self.q('nonkey | alice')), set(['blue']))
 
+    def test_prepared_query(self):
+        for s in ('alice', 'alice | bob', '~(alice & carol)', 'nonkey',
+                  '(bob|nonkey) & ~ alice', ''):
+            q = self.discodb.prepare(s)
+            results = list(self.discodb.query(Q.parse(s)))
+            self.assertEquals(list(self.discodb.query(q)), results)
+            self.assertEquals(list(self.discodb.query(q)), results)
+            self.assertEquals(list(self.discodb.query(s)), results)
+        self.assertRaises(DiscoDBError, self.discodb.prepare, 'alice &')
+        self.assertRaises(DiscoDBError, self.discodb.prepare, '(alice')
+
+    def test_facet_counts(self):
+        facets = ['alice', 'bob', 'carol', 'nonkey']
+        self.assertEquals(self.discodb.facet_counts('alice | bob', facets),
+                          [('alice', 1), ('bob', 1), ('carol', 2), ('nonkey', 0)])
+        self.assertEquals(self.discodb.facet_counts(Q.parse('bob'), facets, top=2),
+                          [('bob', 1), ('carol', 1)])
+        self.assertEquals(self.discodb.facet_counts('nonkey', facets, top=9),
+                          [(f, 0) for f in facets])
+
+    def test_min_match(self):
+        min_match = self.discodb.min_match
+        self.assertEquals(min_match(['alice', 'carol'], 1, 10),
+                          [('blue', 2), ('red', 1)])
+        self.assertEquals(min_match(['alice', 'carol'], 2, 10), [('blue', 2)])
+        self.assertEquals(min_match(['bob', 'carol', 'nonkey'], 1, 1),
+                          [('red', 2)])
+        self.assertEquals(min_match(['alice', 'bob'], 2, 10), [])
+
+    def test_query_patterns(self):
+        query = self.discodb.query
+        self.assertEquals(set(query(Q.prefix('c'))), set(['blue', 'red']))
+        self.assertEquals(set(query(Q.prefix('a') | Q.prefix('b'))),
+                          set(['blue', 'red']))
+        self.assertEquals(set(query(Q.prefix('x'))), set())
+        self.assertEquals(set(query(~Q.prefix('b'))), set(['blue']))
+        self.assertEquals(set(query(Q.glob('?o*') & Q.parse('alice'))), set())
+        self.assertEquals(set(query(Q.glob('*o*'))), set(['red', 'blue']))
+        self.assertEquals(set(query(Q.glob('b?b'))), set(['red']))
+        self.assertEquals(len(query(Q.glob('*l*') & ~Q.parse('bob'))), 1)
+
+class TestMetaQuery(unittest.TestCase):
+    def setUp(self):
+        self.discodb = DiscoDB(
+            (('a', ('b', 'c')),
+            ('b', ('c', 'd')),
+            ('c', ('a',)),
+            ('d', ('x',))),
+        )
+
+    def q(self, s):
+        return self.discodb.query(Q.parse(s))
+
+    def test_query_results(self):
+        self.assertEquals(sorted(self.q('*a')), ['a', 'c', 'd'])
+        self.assertEquals(sorted(self.q('**c')), ['a', 'c', 'd'])
+        self.assertEquals(sorted(self.q('*a & *b')), ['a'])
+        self.assertEquals(sorted(self.q('*d')), [])
+        self.assertEquals(sorted(self.q('~*a')), ['b', 'x'])
+        self.assertEquals(sorted(self.q('*(a | d) & ~c')), ['c', 'd'])
+
+    def test_query_prepared(self):
+        for s in ('*a', '**c', '*a & *b', '~*a', '*(a | d) & ~c', '+b'):
+            self.assertEquals(sorted(self.discodb.query(s)),
+                              sorted(self.q(s)))
+
+    def test_query_resolved(self):
+        for s in ('*a', '**a | *b', '*~c & ~*d', '***(a & b)'):
+            q = Q.parse(s)
+            self.assertEquals(sorted(self.discodb.query(q)),
+                              sorted(self.discodb.query(q.resolve(self.discodb))))
+
+class TestMultisetQuery(unittest.TestCase):
+    def setUp(self):
+        self.discodb = DiscoDB(
+            (('alice', ('blue', 'blue', 'red')),
+            ('bob', ('red', 'red')),
+            ('carol', ('blue', 'green'))),
+        )
+
+    def q(self, s):
+        return self.discodb.query(Q.parse(s))
+
+    def test_query_results(self):
+        self.assertEquals(sorted(self.q('alice')), ['blue', 'red'])
+        self.assertEquals(sorted(self.q('alice & bob')), ['red'])
+        self.assertEquals(sorted(self.q('bob | carol')),
+                          ['blue', 'green', 'red'])
+        self.assertEquals(sorted(self.q('alice & ~carol')), ['red'])
+        self.assertEquals(sorted(self.q('~alice')), ['green'])
+
+class TestParallelQuery(unittest.TestCase):
+    def setUp(self):
+        self.discodb = DiscoDB(('%d' % k,
+                                ('%d' % v for v in xrange(k, 100000, k + 1)))
+                               for k in xrange(1, 20))
+
+    def test_query_results(self):
+        for s in ('1', '1 & 2', '1 | ~3', '2 & ~5 & (3 | 4)'):
+            q = Q.parse(s)
+            self.assertEquals(list(self.discodb.query(q, threads=4)),
+                              list(self.discodb.query(q)))
+
+    def test_query_offset_limit(self):
+        q = Q.parse('1 | 2')
+        results = list(self.discodb.query(q))
+        self.assertEquals(list(self.discodb.query(q, offset=10000, limit=100,
+                                                  threads=4)),
+                          results[10000:10100])
+
+class TestCache(unittest.TestCase):
+    def setUp(self):
+        self.discodb = DiscoDB((('alice', ('blue',)),
+                                ('bob', ('red',)),
+                                ('carol', ('blue', 'red'))))
+        self.cache = DiscoDBCache(1 << 20)
+        self.discodb.set_cache(self.cache)
+
+    def test_hits(self):
+        self.assertEquals(list(self.discodb['carol']), ['blue', 'red'])
+        self.assertEquals(list(self.discodb['carol']), ['blue', 'red'])
+        q = Q.parse('alice | bob')
+        self.assertEquals(sorted(self.discodb.query(q)), ['blue', 'red'])
+        self.assertEquals(sorted(self.discodb.query(q)), ['blue', 'red'])
+        stats = self.cache.stats()
+        self.assertTrue(stats['hits'] > 0)
+        self.assertEquals(stats['misses'], 2)
+        self.assertEquals(stats['num_entries'], 2)
+
+    def test_evictions(self):
+        discodb = DiscoDB(('%d' % k, ('%d' % v for v in xrange(k % 10 + 1)))
+                          for k in xrange(100))
+        cache = DiscoDBCache(1024)
+        discodb.set_cache(cache)
+        for k in xrange(100):
+            self.assertEquals(len(list(discodb['%d' % k])), k % 10 + 1)
+        stats = cache.stats()
+        self.assertTrue(stats['evictions'] > 0)
+        self.assertTrue(stats['size'] <= 1024)
+
+    def test_too_large(self):
+        discodb = DiscoDB((('big', ('%d' % v for v in xrange(1000))),
+                           ('small', ('1', '2'))))
+        cache = DiscoDBCache(1024)
+        discodb.set_cache(cache)
+        for n in xrange(2):
+            self.assertEquals(len(list(discodb['big'])), 1000)
+            self.assertEquals(len(list(discodb.query(Q.parse('big | small')))),
+                              1000)
+        self.assertEquals(cache.stats()['hits'], 0)
+        self.assertEquals(cache.stats()['num_entries'], 2)
+        self.assertEquals(list(discodb.query(Q.parse('small'), limit=1)),
+                          ['1'])
+        self.assertEquals(cache.stats()['num_entries'], 2)
+
+    def test_shared(self):
+        other = DiscoDB((('carol', ('%d' % v for v in xrange(1000))),))
+        other.set_cache(self.cache)
+        self.assertEquals(list(self.discodb['carol']), ['blue', 'red'])
+        self.assertEquals(len(list(other['carol'])), 1000)
+        self.assertEquals(list(self.discodb['carol']), ['blue', 'red'])
+        reloaded = DiscoDB.loads(other.dumps())
+        reloaded.set_cache(self.cache)
+        self.assertEquals(len(list(reloaded['carol'])), 1000)
+        self.assertEquals(self.cache.stats()['misses'], 3)
+
 
 if __name__ == '__main__':
     unittest.TextTestRunner().run(doctest.DocTestSuite(query))
@@ -1,6 +1,8 @@
 
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,23 +12,39 @@
 #include <ddb_internal.h>
 
 #include <ddb_huffman.h>
+#include <ddb_cache.h>
 
 #define PAGE_MASK (~(getpagesize() - 1))
 #define PAGE_ALIGN(addr) ((intptr_t)(addr) & PAGE_MASK)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 static const char *ERR_STR[] = {
     "Ok",
     "Out of memory",
-    "Queries are not supported on multisets",
+    "Query not supported",
     "Buffer too small",
     "Buffer not discodb",
     "Invalid buffer size",
     "Couldn't get the file size",
     "Memory map failed",
-    "Invalid file descriptor",
-    "Write failed"
+    "Write failed",
+    "Invalid value ID",
+    "Locking memory failed",
+    "Invalid view",
+    "Invalid query"
 };
 
+/* errors are kept per thread, so that a db can be shared by many
+   readers without any of them writing to it */
+static __thread const struct ddb *error_db;
+static __thread int error_code;
+
+void ddb_set_error(const struct ddb *db, int err)
+{
+    error_db = db;
+    error_code = err;
+}
+
 static void *acalloc(size_t size)
 {
 #ifdef DDB_ALLOC_ALIGN
@@ -40,23 +58,64 @@ static void *acalloc(size_t size)
 #endif
 }
 
+static int decode_value(struct ddb_cursor *c, const char *data, uint64_t len)
+{
+    const struct ddb *db = c->db;
+
+    /* decode straight to the caller's buffer if the value fits */
+    if (c->into_buf && !ddb_decompress(db->codebook, data, len,
+            &c->entry.length, c->into_buf, c->into_buf_len)){
+        c->entry.data = c->into_buf;
+        return 0;
+    }
+    /* otherwise grow the cursor's buffer to fit exactly the largest
+       value seen so far */
+    while (ddb_decompress(db->codebook, data, len, &c->entry.length,
+            c->decode_buf, c->decode_buf_len)){
+        char *buf;
+        if (!(buf = realloc(c->decode_buf, c->entry.length)))
+            return -1;
+        c->decode_buf = buf;
+        c->decode_buf_len = c->entry.length;
+    }
+    c->entry.data = c->decode_buf;
+    return 0;
+}
+
+static void get_item(struct ddb_cursor *c,
+                     keyid_t id,
+                     struct ddb_delta_cursor *delta)
+{
+    const struct ddb *db = c->db;
+    const char *p = &db->buf[db->key2values[id]];
+
+    c->entry.length = *(uint32_t*)p;
+    c->entry.data = &p[4];
+
+    if (delta)
+        ddb_delta_cursor(delta, &p[4 + c->entry.length]);
+}
+
 int ddb_get_valuestr(struct ddb_cursor *c, valueid_t id)
 {
+    c->cur_id = id;
     if (c->no_valuestr)
         return c->errno;
+    if (c->key_results){
+        get_item(c, id - 1, NULL);
+        return c->errno;
+    }
 
     const struct ddb *db = c->db;
     uint64_t len = db->id2value[id] - db->id2value[id - 1];
     const char *data = &db->buf[db->id2value[id - 1]];
 
     if (HASFLAG(db, F_COMPRESSED)){
-        if (ddb_decompress(db->codebook, data, len, &c->entry.length,
-                &c->decode_buf, &c->decode_buf_len)){
+        if (decode_value(c, data, len)){
             c->errno = DDB_ERR_OUT_OF_MEMORY;
             c->entry.length = 0;
             c->entry.data = NULL;
         }
-        c->entry.data = c->decode_buf;
     }else{
         c->entry.length = len;
         c->entry.data = data;
@@ -64,20 +123,6 @@ int ddb_get_valuestr(struct ddb_cursor *c, valueid_t id)
     return c->errno;
 }
 
-static void get_item(struct ddb_cursor *c,
-                     keyid_t id,
-                     struct ddb_delta_cursor *delta)
-{
-    const struct ddb *db = c->db;
-    const char *p = &db->buf[db->key2values[id]];
-
-    c->entry.length = *(uint32_t*)p;
-    c->entry.data = &p[4];
-
-    if (delta)
-        ddb_delta_cursor(delta, &p[4 + c->entry.length]);
-}
-
 struct ddb *ddb_new()
 {
     struct ddb *db = NULL;
@@ -92,22 +137,219 @@ int ddb_load(struct ddb *db, int fd)
 }
 
 int ddb_loado(struct ddb *db, int fd, off_t offset)
+{
+    return ddb_load_flags(db, fd, offset, 0);
+}
+
+static uint32_t num_key_samples(const struct ddb *db)
+{
+    return (db->num_keys + KEY_SAMPLE_INTERVAL - 1) / KEY_SAMPLE_INTERVAL;
+}
+
+static uint64_t get_section(const struct ddb *db,
+                            uint32_t sect,
+                            const char **start)
+{
+    switch (sect){
+        case DDB_SECTION_HASH:
+            if (!HASFLAG(db, F_HASH))
+                return 0;
+            *start = (const char*)db->hash;
+            return (const char*)db->key2values - *start;
+        case DDB_SECTION_KEY2VALUES:
+            *start = (const char*)db->key2values;
+            return (db->num_keys + 1LLU) * sizeof(uint64_t);
+        case DDB_SECTION_ITEMS:
+            *start = &db->buf[db->key2values[0]];
+            return db->key2values[db->num_keys] - db->key2values[0];
+        case DDB_SECTION_ID2VALUE:
+            *start = (const char*)db->id2value;
+            return (db->num_uniq_values + 1LLU) * sizeof(uint64_t);
+        case DDB_SECTION_VALUES:
+            *start = &db->buf[db->id2value[0]];
+            return db->id2value[db->num_uniq_values] - db->id2value[0];
+        case DDB_SECTION_CODEBOOK:
+            if (!HASFLAG(db, F_COMPRESSED))
+                return 0;
+            *start = (const char*)db->codebook;
+            return DDB_CODEBOOK_SIZE * sizeof(struct ddb_codebook);
+        case DDB_SECTION_SKIPS:
+            if (!db->skips)
+                return 0;
+            *start = (const char*)db->skips;
+            return &db->buf[db->skips[db->num_keys]] - *start;
+        case DDB_SECTION_VALUE_INDEX:
+            if (!db->value_index)
+                return 0;
+            *start = db->value_hash - 8;
+            return (const char*)&db->value_index[db->num_uniq_values] - *start;
+        case DDB_SECTION_INVERTED:
+            if (!db->inverted)
+                return 0;
+            *start = (const char*)db->inverted;
+            return &db->buf[db->inverted[db->num_uniq_values]] - *start;
+        case DDB_SECTION_KEY_INDEX:
+            if (!db->key_samples)
+                return 0;
+            *start = db->rank ? (const char*)db->rank:
+                                (const char*)db->key_samples;
+            return &db->buf[db->key_samples[num_key_samples(db)]] - *start;
+    }
+    return 0;
+}
+
+/* madvise() and friends work on whole pages: extend the section to
+   the page boundaries around it */
+static uint64_t section_pages(const struct ddb *db,
+                              uint32_t sect,
+                              char **start)
+{
+    const char *p = NULL;
+    uint64_t len;
+
+    if (!(len = get_section(db, sect, &p)))
+        return 0;
+    *start = (char*)PAGE_ALIGN(p);
+    return len + (p - *start);
+}
+
+int ddb_advise(const struct ddb *db, uint32_t sections, int advice)
+{
+    uint32_t sect;
+    int err = 0;
+
+    switch (advice){
+        case DDB_ADVICE_RANDOM:
+            advice = MADV_RANDOM;
+            break;
+        case DDB_ADVICE_SEQUENTIAL:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case DDB_ADVICE_WILLNEED:
+            advice = MADV_WILLNEED;
+            break;
+        case DDB_ADVICE_DONTNEED:
+            advice = MADV_DONTNEED;
+            break;
+        default:
+            advice = MADV_NORMAL;
+    }
+    for (sect = 1; sect & DDB_SECTION_ALL; sect <<= 1){
+        char *p;
+        uint64_t len;
+        if (!(sections & sect) || !(len = section_pages(db, sect, &p)))
+            continue;
+        if (madvise(p, len, advice))
+            err = -1;
+    }
+    return err;
+}
+
+static uint64_t nonresident_bytes(char *p, uint64_t len)
+{
+    const uint64_t psize = getpagesize();
+    unsigned char resident[1024];
+    uint64_t i, j, num_bytes = 0;
+
+    for (i = 0; i < len; i += sizeof(resident) * psize){
+        uint64_t n = MIN(len - i, sizeof(resident) * psize);
+        if (mincore(&p[i], n, (void*)resident))
+            memset(resident, 0, sizeof(resident));
+        for (j = 0; j < n; j += psize)
+            if (!(resident[j / psize] & 1))
+                num_bytes += psize;
+    }
+    return num_bytes;
+}
+
+uint64_t ddb_prewarm(const struct ddb *db, uint32_t sections)
+{
+    const uint64_t psize = getpagesize();
+    uint64_t i, len, num_bytes = 0;
+    uint32_t sect;
+    char *p;
+
+    /* count first: readahead triggered by touching one section
+       would hide pages of the next one */
+    for (sect = 1; sect & DDB_SECTION_ALL; sect <<= 1)
+        if ((sections & sect) && (len = section_pages(db, sect, &p)))
+            num_bytes += nonresident_bytes(p, len);
+
+    for (sect = 1; sect & DDB_SECTION_ALL; sect <<= 1){
+        if (!(sections & sect) || !(len = section_pages(db, sect, &p)))
+            continue;
+        madvise(p, len, MADV_WILLNEED);
+        for (i = 0; i < len; i += psize)
+            *(volatile char*)&p[i];
+    }
+    return num_bytes;
+}
+
+static int mlock_sections(struct ddb *db, uint32_t sections)
+{
+    uint32_t sect;
+    for (sect = 1; sect & DDB_SECTION_ALL; sect <<= 1){
+        char *p;
+        uint64_t len;
+        if (!(sections & sect) || !(len = section_pages(db, sect, &p)))
+            continue;
+        if (mlock(p, len)){
+            ddb_set_error(db, DDB_ERR_MLOCK_FAILED);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ddb_load_flags(struct ddb *db, int fd, off_t offset, uint32_t flags)
 {
     struct stat nfo;
     off_t mmap_offset = PAGE_ALIGN(offset);
+    int mmap_flags = MAP_SHARED;
+    int populate = flags & DDB_LOAD_POPULATE;
 
     if (fstat(fd, &nfo)){
-        db->errno = DDB_ERR_STAT_FAILED;
+        ddb_set_error(db, DDB_ERR_STAT_FAILED);
         return -1;
     }
+#ifdef MAP_POPULATE
+    /* huge pages must be requested before the mapping is faulted in */
+    if (populate && !(flags & DDB_LOAD_HUGEPAGES)){
+        mmap_flags |= MAP_POPULATE;
+        populate = 0;
+    }
+#endif
     db->mmap_size = nfo.st_size - mmap_offset;
-    db->mmap = mmap(0, db->mmap_size, PROT_READ, MAP_SHARED, fd, mmap_offset);
+    db->mmap = mmap(0, db->mmap_size, PROT_READ, mmap_flags, fd, mmap_offset);
 
     if (db->mmap == MAP_FAILED){
-        db->errno = DDB_ERR_MMAP_FAILED;
+        db->mmap = NULL;
+        ddb_set_error(db, DDB_ERR_MMAP_FAILED);
         return -1;
     }
-    return ddb_loads(db, db->mmap + (offset - mmap_offset), nfo.st_size - offset);
+#ifdef MADV_HUGEPAGE
+    if (flags & DDB_LOAD_HUGEPAGES)
+        madvise(db->mmap, db->mmap_size, MADV_HUGEPAGE);
+#endif
+    if (ddb_loads(db, db->mmap + (offset - mmap_offset), nfo.st_size - offset))
+        return -1;
+    db->load_flags = flags;
+
+    if (flags & DDB_LOAD_RANDOM){
+        ddb_advise(db, DDB_SECTION_INDEX, DDB_ADVICE_WILLNEED);
+        ddb_advise(db, DDB_SECTION_ITEMS | DDB_SECTION_VALUES,
+                   DDB_ADVICE_RANDOM);
+    }
+    if (flags & DDB_LOAD_SEQUENTIAL)
+        ddb_advise(db, DDB_SECTION_ITEMS | DDB_SECTION_VALUES,
+                   DDB_ADVICE_SEQUENTIAL);
+    if (populate)
+        ddb_prewarm(db, DDB_SECTION_ALL);
+    if (flags & DDB_LOAD_MLOCK)
+        return mlock_sections(db, DDB_SECTION_HASH |
+                                  DDB_SECTION_KEY2VALUES |
+                                  DDB_SECTION_ID2VALUE);
+    return 0;
 }
 
 static const uint64_t *load_sect(const struct ddb *db, uint64_t offset)
@@ -115,19 +357,58 @@ static const uint64_t *load_sect(const struct ddb *db, uint64_t offset)
     return (const uint64_t*)&db->buf[offset];
 }
 
+/* The header ends before max_value_size in older files. Fields that
+   were appended later are there only if their flags are set, and each
+   flag needs the header up to its field. */
+#define FIELD_END(field) \
+    (offsetof(struct ddb_header, field) + sizeof(uint64_t))
+
+static uint64_t header_size(uint64_t flags)
+{
+    if (flags & F_SORTED)
+        return FIELD_END(key_samples_offs);
+    if (flags & F_INVERTED)
+        return FIELD_END(inverted_offs);
+    if (flags & F_VALUE_INDEX)
+        return FIELD_END(value_index_offs);
+    if (flags & F_SKIPS)
+        return FIELD_END(skips_offs);
+    if (flags & F_MAXVALUE)
+        return FIELD_END(max_value_size);
+    return offsetof(struct ddb_header, max_value_size);
+}
+
+/* Tells apart the data of every load, for the cache. */
+static uint64_t next_load_id()
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static uint64_t num_loads;
+    uint64_t id;
+
+    pthread_mutex_lock(&lock);
+    id = ++num_loads;
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
 int ddb_loads(struct ddb *db, const char *data, uint64_t length)
 {
     const struct ddb_header *head = (const struct ddb_header*)data;
 
-    if (length < sizeof(struct ddb_header)){
-        db->errno = DDB_ERR_BUFFER_TOO_SMALL;
+    if (length < header_size(0)){
+        ddb_set_error(db, DDB_ERR_BUFFER_TOO_SMALL);
         return -1;
-    }if (head->magic != DISCODB_MAGIC){
-        db->errno = DDB_ERR_BUFFER_NOT_DISCODB;
+    }if (head->magic != DISCODB_MAGIC &&
+            head->magic != DISCODB_MAGIC_SORTED){
+        ddb_set_error(db, DDB_ERR_BUFFER_NOT_DISCODB);
+        return -1;
+    }
+    if (length < header_size(head->flags)){
+        ddb_set_error(db, DDB_ERR_BUFFER_TOO_SMALL);
         return -1;
     }
     if (head->size > length){
-        db->errno = DDB_ERR_INVALID_BUFFER_SIZE;
+        ddb_set_error(db, DDB_ERR_INVALID_BUFFER_SIZE);
         return -1;
     }
 
@@ -137,14 +418,36 @@ int ddb_loads(struct ddb *db, const char *data, uint64_t length)
     db->num_values = head->num_values;
     db->num_uniq_values = head->num_uniq_values;
     db->flags = head->flags;
-    db->errno = 0;
+    db->load_id = next_load_id();
+
+    db->max_value_size = HASFLAG(db, F_MAXVALUE) ? head->max_value_size: 0;
 
     db->key2values = load_sect(db, head->key2values_offs);
     db->id2value = load_sect(db, head->id2value_offs);
     db->hash = load_sect(db, head->hash_offs);
+    db->skips = HASFLAG(db, F_SKIPS) ? load_sect(db, head->skips_offs): NULL;
+    db->value_hash = NULL;
+    db->value_index = NULL;
+    if (HASFLAG(db, F_VALUE_INDEX)){
+        /* hash size, hash padded to 8 bytes, ID of each hash slot */
+        const uint64_t *p = load_sect(db, head->value_index_offs);
+        db->value_hash = (const char*)&p[1];
+        db->value_index = (const valueid_t*)&db->value_hash[(p[0] + 7) & ~7ULL];
+    }
+    db->inverted = HASFLAG(db, F_INVERTED) ?
+        load_sect(db, head->inverted_offs): NULL;
+    db->rank = NULL;
+    db->key_samples = NULL;
+    if (HASFLAG(db, F_SORTED)){
+        if (HASFLAG(db, F_HASH))
+            db->rank = (const keyid_t*)load_sect(db, head->rank_offs);
+        db->key_samples = load_sect(db, head->key_samples_offs);
+    }
 
     db->codebook = (const struct ddb_codebook*)&db->buf[head->codebook_offs];
 
+    /* errors of an earlier load don't stick to the new data */
+    ddb_set_error(db, 0);
     return 0;
 }
 
@@ -155,11 +458,11 @@ void ddb_free(struct ddb *db)
     free(db);
 }
 
-char *ddb_dumps(struct ddb *db, uint64_t *length)
+char *ddb_dumps(const struct ddb *db, uint64_t *length)
 {
     char *d = NULL;
     if (!(d = acalloc(db->size))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
     memcpy(d, db->buf, db->size);
@@ -167,7 +470,7 @@ char *ddb_dumps(struct ddb *db, uint64_t *length)
     return d;
 }
 
-int ddb_dump(struct ddb *db, int fd)
+int ddb_dump(const struct ddb *db, int fd)
 {
     const int bsize = 8192;
     uint64_t offs = 0;
@@ -176,7 +479,7 @@ int ddb_dump(struct ddb *db, int fd)
         size_t c = db->size - offs > bsize ? bsize: db->size - offs;
         ssize_t n = write(fd, &db->buf[offs], c);
         if (n == -1){
-            db->errno = DDB_ERR_WRITEFAILED;
+            ddb_set_error(db, DDB_ERR_WRITEFAILED);
             return -1;
         }
         offs += n;
@@ -186,24 +489,39 @@ int ddb_dump(struct ddb *db, int fd)
 
 static const struct ddb_entry *key_cursor_next(struct ddb_cursor *c)
 {
-    if (c->cursor.keys.i == c->db->num_keys)
+    if (c->cursor.keys.i == c->cursor.keys.end)
         return NULL;
 
     get_item(c, c->cursor.keys.i++, NULL);
     return &c->entry;
 }
 
-struct ddb_cursor *ddb_keys(struct ddb *db)
+static void clamp_range(const struct ddb *db, uint32_t *start, uint32_t *end)
+{
+    if (*end > db->num_keys)
+        *end = db->num_keys;
+    if (*start > *end)
+        *start = *end;
+}
+
+struct ddb_cursor *ddb_keys(const struct ddb *db)
+{
+    return ddb_keys_range(db, 0, db->num_keys);
+}
+
+struct ddb_cursor *ddb_keys_range(const struct ddb *db, uint32_t start, uint32_t end)
 {
     struct ddb_cursor *c = NULL;
     if (!(c = acalloc(sizeof(struct ddb_cursor)))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
+    clamp_range(db, &start, &end);
     c->db = db;
-    c->cursor.keys.i = 0;
+    c->cursor.keys.i = start;
+    c->cursor.keys.end = end;
     c->next = key_cursor_next;
-    c->num_items = db->num_keys;
+    c->num_items = end - start;
     return c;
 }
 
@@ -216,11 +534,11 @@ static const struct ddb_entry *unique_values_cursor_next(struct ddb_cursor *c)
     return &c->entry;
 }
 
-struct ddb_cursor *ddb_unique_values(struct ddb *db)
+struct ddb_cursor *ddb_unique_values(const struct ddb *db)
 {
     struct ddb_cursor *c = NULL;
     if (!(c = acalloc(sizeof(struct ddb_cursor)))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
     c->db = db;
@@ -230,11 +548,49 @@ struct ddb_cursor *ddb_unique_values(struct ddb *db)
     return c;
 }
 
+/* returns 1 if the value with the given ID equals value */
+static int value_matches(struct ddb_cursor *c,
+                         valueid_t id,
+                         const struct ddb_entry *value)
+{
+    if (ddb_get_valuestr(c, id))
+        return -1;
+    return c->entry.length == value->length &&
+           !memcmp(c->entry.data, value->data, value->length);
+}
+
+/* Finds the ID of a value with the value index, if the db has one,
+   otherwise by scanning all the values. Returns 0 if there is no such
+   value. */
+uint32_t ddb_value_id(const struct ddb *db, const struct ddb_entry *value)
+{
+    struct ddb_cursor c;
+    valueid_t id = 0;
+    int found = 0;
+
+    memset(&c, 0, sizeof(struct ddb_cursor));
+    c.db = db;
+    if (db->value_index){
+        uint32_t slot = cmph_search_packed((void*)db->value_hash,
+            value->data, value->length);
+        if (slot < db->num_uniq_values){
+            id = db->value_index[slot];
+            found = value_matches(&c, id, value);
+        }
+    }else
+        while (!found && id < db->num_uniq_values)
+            found = value_matches(&c, ++id, value);
+    free(c.decode_buf);
+    if (found == -1)
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    return found == 1 ? id: 0;
+}
+
 static const struct ddb_entry *values_cursor_next(struct ddb_cursor *c)
 {
     /* skip empty values */
     while (!c->cursor.values.cur.num_left){
-        if (c->cursor.values.i == c->db->num_keys)
+        if (c->cursor.values.i == c->cursor.values.end)
             return NULL;
         get_item(c, c->cursor.values.i++, &c->cursor.values.cur);
     }
@@ -244,20 +600,65 @@ static const struct ddb_entry *values_cursor_next(struct ddb_cursor *c)
     return &c->entry;
 }
 
-struct ddb_cursor *ddb_values(struct ddb *db)
+struct ddb_cursor *ddb_values(const struct ddb *db)
+{
+    return ddb_values_range(db, 0, db->num_keys);
+}
+
+struct ddb_cursor *ddb_values_range(const struct ddb *db,
+                                    uint32_t start,
+                                    uint32_t end)
 {
     struct ddb_cursor *c = NULL;
     if (!(c = acalloc(sizeof(struct ddb_cursor)))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
+    clamp_range(db, &start, &end);
     c->db = db;
-    c->cursor.values.i = 0;
+    c->cursor.values.i = start;
+    c->cursor.values.end = end;
     c->next = values_cursor_next;
-    c->num_items = db->num_values;
+    /* the number of values in a partial range is not known
+       without scanning it */
+    if (start == 0 && end == db->num_keys)
+        c->num_items = db->num_values;
     return c;
 }
 
+uint32_t ddb_partition(const struct ddb *db, uint32_t num_parts, uint32_t *bounds)
+{
+    /* Splits keys to num_parts ranges of roughly equal size in bytes,
+       bounds[i]..bounds[i + 1] being the i'th range. Returns the
+       number of non-empty ranges, which is smaller than num_parts
+       if there are fewer keys than parts. */
+    const uint64_t first = db->key2values[0];
+    const uint64_t total = db->key2values[db->num_keys] - first;
+    uint32_t i, n = 0;
+
+    if (!num_parts)
+        return 0;
+    bounds[0] = 0;
+    for (i = 1; i < num_parts; i++){
+        uint64_t target = first + total * i / num_parts;
+        uint32_t lo = bounds[i - 1], hi = db->num_keys;
+        /* first key that starts at or after the target offset */
+        while (lo < hi){
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (db->key2values[mid] < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        bounds[i] = lo;
+    }
+    bounds[num_parts] = db->num_keys;
+    for (i = 0; i < num_parts; i++)
+        if (bounds[i + 1] > bounds[i])
+            ++n;
+    return n;
+}
+
 static const struct ddb_entry *value_cursor_next(struct ddb_cursor *c)
 {
     if (c->cursor.value.num_left){
@@ -279,171 +680,1171 @@ int key_matches(const struct ddb_cursor *c, const struct ddb_entry *key)
   return c->entry.length == key->length && !memcmp(c->entry.data, key->data, key->length);
 }
 
-struct ddb_cursor *ddb_getitem(struct ddb *db, const struct ddb_entry *key)
+/* Returns the ID of a key, or num_keys if the db doesn't have it. */
+static keyid_t find_key(struct ddb_cursor *c,
+                        const struct ddb_entry *key,
+                        struct ddb_delta_cursor *delta)
+{
+    const struct ddb *db = c->db;
+    keyid_t id;
+
+    if (HASFLAG(db, F_HASH)){
+        /* hash exists, perform O(1) lookup */
+        id = cmph_search_packed((void*)db->hash, key->data, key->length);
+        /* sorted keys are not in the order of the hash */
+        if (db->rank && id < db->num_keys)
+            id = db->rank[id];
+        if (id < db->num_keys){
+            get_item(c, id, delta);
+            if (key_matches(c, key))
+                return id;
+        }
+        return db->num_keys;
+    }
+    /* no hash, perform linear scan */
+    id = db->num_keys;
+    while (id--){
+        get_item(c, id, delta);
+        if (key_matches(c, key))
+            return id;
+    }
+    return db->num_keys;
+}
+
+uint32_t ddb_key_id(const struct ddb *db, const struct ddb_entry *key)
+{
+    struct ddb_cursor c;
+    memset(&c, 0, sizeof(c));
+    c.db = db;
+    return find_key(&c, key, NULL);
+}
+
+/* Terms of prepared queries hold the IDs of their keys in place of the
+   keys, see ddb_prepare(). */
+static keyid_t term_key_id(const struct ddb_query_term *term, uint32_t i)
 {
+    keyid_t id;
+    memcpy(&id, &term->key.data[i * sizeof(keyid_t)], sizeof(keyid_t));
+    return id;
+}
 
+static struct ddb_cursor *getitem_id(const struct ddb *db, keyid_t id)
+{
     struct ddb_cursor *c = NULL;
     if (!(c = acalloc(sizeof(struct ddb_cursor)))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
     c->db = db;
 
-    if (HASFLAG(db, F_HASH)){
-        /* hash exists, perform O(1) lookup */
-        uint32_t id = cmph_search_packed((void*)db->hash,
-            key->data, key->length);
-        if (id < db->num_keys)
-            get_item(c, id, &c->cursor.value);
-        if (id >= db->num_keys || !key_matches(c, key)){
-            c->num_items = c->cursor.value.num_left = 0;
-            c->next = empty_next;
-            return c;
-        }
-    }else{
-        /* no hash, perform linear scan */
-        uint32_t i = db->num_keys;
-        while (i--){
-            get_item(c, i, &c->cursor.value);
-            if (key_matches(c, key))
-                goto found;
-        }
-        c->num_items = c->cursor.value.num_left = 0;
+    if (id == db->num_keys){
         c->next = empty_next;
         return c;
     }
-found:
+    get_item(c, id, &c->cursor.value);
     c->num_items = c->cursor.value.num_left;
+    if (db->skips)
+        c->skips = (const valueid_t*)&db->buf[db->skips[id]];
     c->next = value_cursor_next;
     return c;
 }
 
-struct ddb_cursor *ddb_query(struct ddb *db,
-                             const struct ddb_query_clause *clauses,
-                             uint32_t length)
+static struct ddb_cursor *getitem(const struct ddb *db,
+                                  const struct ddb_entry *key)
 {
-    return ddb_query_view(db, clauses, length, NULL);
+    return getitem_id(db, ddb_key_id(db, key));
 }
 
-struct ddb_cursor *ddb_query_view(struct ddb *db,
-                                  const struct ddb_query_clause *clauses,
-                                  uint32_t length,
-                                  const struct ddb_view *view)
+static const struct ddb_entry *ids_cursor_next(struct ddb_cursor *c)
 {
-    struct ddb_cursor *c = NULL;
-    /* CNF queries are not supported for multisets */
-    if (HASFLAG(db, F_MULTISET)){
-        db->errno = DDB_ERR_QUERY_NOT_SUPPORTED;
+    if (c->cursor.ids.i == c->cursor.ids.num_ids)
         return NULL;
-    }
+    if (ddb_get_valuestr(c, c->cursor.ids.ids[c->cursor.ids.i++]))
+        return NULL;
+    return &c->entry;
+}
 
+/* takes ownership of ids */
+static struct ddb_cursor *ids_cursor(const struct ddb *db,
+                                     valueid_t *ids,
+                                     uint32_t num_ids,
+                                     uint32_t num_items)
+{
+    struct ddb_cursor *c = NULL;
     if (!(c = acalloc(sizeof(struct ddb_cursor)))){
-        db->errno = DDB_ERR_OUT_OF_MEMORY;
+        free(ids);
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
         return NULL;
     }
+    c->db = db;
+    c->cursor.ids.ids = ids;
+    c->cursor.ids.num_ids = num_ids;
+    c->num_items = num_items;
+    c->next = ids_cursor_next;
+    return c;
+}
+
+/* Collects the keys whose posting lists contain id, as key IDs + 1,
+   for dbs without the inverted section. */
+static int scan_keys(const struct ddb *db,
+                     valueid_t id,
+                     valueid_t **ids,
+                     uint32_t *num_ids)
+{
+    struct ddb_cursor c;
+    uint32_t k, size = 0;
+
+    memset(&c, 0, sizeof(struct ddb_cursor));
+    c.db = db;
+    *ids = NULL;
+    *num_ids = 0;
+    for (k = 0; k < db->num_keys; k++){
+        struct ddb_delta_cursor d;
+        get_item(&c, k, &d);
+        if (db->skips)
+            ddb_delta_cursor_skip(&d, (const valueid_t*)&db->buf[db->skips[k]],
+                                  d.num_left, id);
+        while (d.num_left && d.cur_id < id)
+            ddb_delta_cursor_next(&d);
+        if (d.cur_id != id)
+            continue;
+        if (*num_ids == size){
+            valueid_t *p;
+            size = size ? size * 2: 64;
+            if (!(p = realloc(*ids, size * sizeof(valueid_t)))){
+                free(*ids);
+                return -1;
+            }
+            *ids = p;
+        }
+        (*ids)[(*num_ids)++] = k + 1;
+    }
+    return 0;
+}
 
-    uint32_t j, k, i = length;
-    uint32_t num_terms = 0;
-    while (i--)
-        num_terms += clauses[i].num_terms;
+static struct ddb_cursor *getkeys(const struct ddb *db,
+                                  const struct ddb_entry *value)
+{
+    struct ddb_cursor *c = NULL;
+    valueid_t *ids;
+    uint32_t num_ids;
+    valueid_t id = ddb_value_id(db, value);
 
+    if (id && !db->inverted){
+        if (scan_keys(db, id, &ids, &num_ids)){
+            ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+            return NULL;
+        }
+        if ((c = ids_cursor(db, ids, num_ids, num_ids)))
+            c->key_results = 1;
+        return c;
+    }
+    if (!(c = acalloc(sizeof(struct ddb_cursor)))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
     c->db = db;
-    c->num_items = 0;
-
-    if (length)
-        c->next = ddb_cnf_cursor_next;
-    else{
+    c->key_results = 1;
+    if (!id){
         c->next = empty_next;
         return c;
     }
+    ddb_delta_cursor(&c->cursor.value, &db->buf[db->inverted[id - 1]]);
+    c->num_items = c->cursor.value.num_left;
+    c->next = value_cursor_next;
+    return c;
+}
 
-    c->cursor.cnf.num_clauses = length;
-    c->cursor.cnf.num_terms = num_terms;
-    c->cursor.cnf.isect_offset = WINDOW_SIZE;
-
-    if (!(c->cursor.cnf.clauses =
-            calloc(length + 1, sizeof(struct ddb_cnf_clause))))
-        goto err;
-    if (!(c->cursor.cnf.terms =
-            calloc(num_terms + 1, sizeof(struct ddb_cnf_term))))
-        goto err;
-    if (!(c->cursor.cnf.isect = calloc(1, WINDOW_SIZE_BYTES)))
-        goto err;
+/* compares keys byte by byte, a prefix coming first */
+static int key_cmp(const struct ddb_entry *x, const struct ddb_entry *y)
+{
+    int c = memcmp(x->data, y->data, MIN(x->length, y->length));
+    if (c)
+        return c;
+    return x->length < y->length ? -1: x->length > y->length;
+}
 
-    for (j = 0, i = 0; i < length; i++){
-        c->cursor.cnf.clauses[i].terms = &c->cursor.cnf.terms[j];
-        c->cursor.cnf.clauses[i].num_terms = clauses[i].num_terms;
+/* Returns the position of the first sorted key >= target. Only the
+   keys between the two samples around target are read, in order. */
+static uint32_t lower_bound(const struct ddb *db,
+                            const struct ddb_entry *target)
+{
+    const uint64_t *samples = db->key_samples;
+    uint32_t i, end, lo = 0, hi = num_key_samples(db);
+    struct ddb_cursor c;
+
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        struct ddb_entry sample = {&db->buf[samples[mid]],
+                                   samples[mid + 1] - samples[mid]};
+        if (key_cmp(&sample, target) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    /* the samples before lo are below target, sample lo is not */
+    memset(&c, 0, sizeof(struct ddb_cursor));
+    c.db = db;
+    end = MIN((uint64_t)lo * KEY_SAMPLE_INTERVAL, db->num_keys);
+    for (i = lo ? (lo - 1) * KEY_SAMPLE_INTERVAL + 1: 0; i < end; i++){
+        get_item(&c, i, NULL);
+        if (key_cmp(&c.entry, target) >= 0)
+            break;
+    }
+    return i;
+}
 
-        for (k = 0; k < clauses[i].num_terms; k++){
-            struct ddb_cnf_term *term = &c->cursor.cnf.terms[j++];
-            if (!(term->cursor = ddb_getitem(db, &clauses[i].terms[k].key)))
-                goto err;
+struct key_position{
+    struct ddb_entry key;
+    keyid_t id;
+};
 
-            if (clauses[i].terms[k].nnot)
-                term->next = ddb_not_next;
-            else
-                term->next = ddb_val_next;
+static int key_position_cmp(const void *p1, const void *p2)
+{
+    return key_cmp(&((const struct key_position*)p1)->key,
+                   &((const struct key_position*)p2)->key);
+}
 
-            term->next(term);
-        }
-    }
+/* Dbs without sorted keys are scanned for the keys in the range, which
+   are then sorted. */
+static struct ddb_cursor *scan_keys_between(const struct ddb *db,
+                                            const struct ddb_entry *lo,
+                                            const struct ddb_entry *hi)
+{
+    struct key_position *keys = NULL;
+    struct ddb_cursor *c, k;
+    valueid_t *ids = NULL;
+    uint32_t i, n = 0;
 
-    if (view){
-        struct ddb_cnf_term *term = &c->cursor.cnf.terms[j];
-        c->cursor.cnf.clauses[i].terms = term;
-        c->cursor.cnf.clauses[i].num_terms = 1;
-        if (!(term->cursor = calloc(1, sizeof(struct ddb_cursor))))
-            goto err;
-        term->cursor->cursor.view.view = view;
-        term->next = ddb_view_next;
-        term->next(term);
-        ++c->cursor.cnf.num_clauses;
-        ++c->cursor.cnf.num_terms;
+    if (!(keys = malloc((db->num_keys + 1) * sizeof(struct key_position))))
+        goto err;
+    memset(&k, 0, sizeof(struct ddb_cursor));
+    k.db = db;
+    for (i = 0; i < db->num_keys; i++){
+        get_item(&k, i, NULL);
+        if ((lo && key_cmp(&k.entry, lo) < 0) ||
+                (hi && key_cmp(&k.entry, hi) >= 0))
+            continue;
+        keys[n].key = k.entry;
+        keys[n++].id = i + 1;
     }
-
+    qsort(keys, n, sizeof(struct key_position), key_position_cmp);
+    if (!(ids = malloc((n + 1) * sizeof(valueid_t))))
+        goto err;
+    for (i = 0; i < n; i++)
+        ids[i] = keys[i].id;
+    free(keys);
+    if ((c = ids_cursor(db, ids, n, n)))
+        c->key_results = 1;
     return c;
 err:
-    db->errno = DDB_ERR_OUT_OF_MEMORY;
-    ddb_free_cursor(c);
+    free(keys);
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
     return NULL;
 }
 
-int ddb_free_cursor(struct ddb_cursor *c)
+/* Keys k with lo <= k < hi in lexicographic order. A NULL bound
+   leaves that end of the range open. */
+struct ddb_cursor *ddb_keys_between(const struct ddb *db,
+                                    const struct ddb_entry *lo,
+                                    const struct ddb_entry *hi)
 {
-    if (c){
-        int errno = c->errno;
-        if(c->next == ddb_cnf_cursor_next){
-            if (c->cursor.cnf.terms){
-                int i = c->cursor.cnf.num_terms;
-                while (i--)
-                    free(c->cursor.cnf.terms[i].cursor);
-            }
-            free(c->cursor.cnf.clauses);
-            free(c->cursor.cnf.terms);
-            free(c->cursor.cnf.isect);
-        }
-        free(c->decode_buf);
-        free(c);
-        return errno;
-    }
-    return 0;
+    if (!db->key_samples)
+        return scan_keys_between(db, lo, hi);
+    return ddb_keys_range(db, lo ? lower_bound(db, lo): 0,
+                              hi ? lower_bound(db, hi): db->num_keys);
 }
 
-uint64_t ddb_resultset_size(const struct ddb_cursor *c)
+/* Sets succ to the first string after all the ones with a prefix: the
+   prefix with its last byte incremented, after dropping trailing 0xff
+   bytes. Returns 0 if there is no such string. buf holds the bytes of
+   succ. */
+static int prefix_successor(const struct ddb_entry *prefix,
+                            char *buf,
+                            struct ddb_entry *succ)
 {
-    return c->num_items;
+    uint32_t n = prefix->length;
+
+    memcpy(buf, prefix->data, n);
+    while (n && (unsigned char)buf[n - 1] == 0xff)
+        --n;
+    if (!n)
+        return 0;
+    ++buf[n - 1];
+    succ->data = buf;
+    succ->length = n;
+    return 1;
 }
 
-uint64_t ddb_cursor_count(struct ddb_cursor *c, int *err)
+/* The keys with a prefix are the ones from the prefix up to but not
+   including its successor. */
+struct ddb_cursor *ddb_keys_prefix(const struct ddb *db,
+                                   const struct ddb_entry *prefix)
 {
-    uint64_t n = 0;
-    c->no_valuestr = 1;
-    *err = 0;
-    while (ddb_next(c, err) && !*err)
+    struct ddb_cursor *c;
+    struct ddb_entry succ;
+    char *buf;
+
+    if (!(buf = malloc(prefix->length + 1))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    if (prefix_successor(prefix, buf, &succ))
+        c = ddb_keys_between(db, prefix, &succ);
+    else
+        c = ddb_keys_between(db, prefix, NULL);
+    free(buf);
+    return c;
+}
+
+/* Matches a key against a glob pattern, in which '*' matches any run
+   of bytes, '?' any single byte and '\' escapes the byte after it. */
+static int glob_match(const struct ddb_entry *pattern,
+                      const struct ddb_entry *key)
+{
+    const char *p = pattern->data;
+    uint32_t i = 0, j = 0, star = 0, mark = 0;
+    int backtrack = 0;
+
+    while (j < key->length){
+        if (i < pattern->length && p[i] == '*'){
+            star = ++i;
+            mark = j;
+            backtrack = 1;
+            continue;
+        }
+        if (i < pattern->length){
+            uint32_t n = p[i] == '\\' && i + 1 < pattern->length ? 2: 1;
+            if ((n == 1 && p[i] == '?') || p[i + n - 1] == key->data[j]){
+                i += n;
+                ++j;
+                continue;
+            }
+        }
+        if (!backtrack)
+            return 0;
+        /* let the last star match one more byte */
+        i = star;
+        j = ++mark;
+    }
+    while (i < pattern->length && p[i] == '*')
+        ++i;
+    return i == pattern->length;
+}
+
+/* the bytes every key matching a glob pattern starts with */
+static uint32_t glob_prefix(const struct ddb_entry *pattern, char *buf)
+{
+    uint32_t i, n = 0;
+    for (i = 0; i < pattern->length; i++){
+        char x = pattern->data[i];
+        if (x == '*' || x == '?')
+            break;
+        if (x == '\\' && i + 1 < pattern->length)
+            x = pattern->data[++i];
+        buf[n++] = x;
+    }
+    return n;
+}
+
+/* adds the posting list of a key to a union, size being the number of
+   lists allocated */
+static int union_add(struct ddb_cursor *c,
+                     keyid_t id,
+                     const struct ddb_delta_cursor *d,
+                     uint32_t *size)
+{
+    struct ddb_union_cursor *u = &c->cursor.unionn;
+    const struct ddb *db = c->db;
+
+    if (!d->num_left)
+        return 0;
+    if (u->num_lists == *size){
+        struct ddb_union_list *p;
+        *size = *size ? *size * 2: 16;
+        if (!(p = realloc(u->lists, *size * sizeof(struct ddb_union_list))))
+            return -1;
+        u->lists = p;
+    }
+    u->lists[u->num_lists].cur = *d;
+    u->lists[u->num_lists].num_items = d->num_left;
+    u->lists[u->num_lists++].skips = db->skips ?
+        (const valueid_t*)&db->buf[db->skips[id]]: NULL;
+    return 0;
+}
+
+/* Collects the posting lists of the keys matched by a prefix or glob
+   term. Only the keys between the prefix and its successor are looked
+   at if the keys are sorted, all of them otherwise. */
+static struct ddb_cursor *pattern_union(const struct ddb *db,
+                                        const struct ddb_query_term *term)
+{
+    struct ddb_cursor *c = NULL;
+    struct ddb_entry prefix, succ;
+    uint32_t i, start = 0, end = db->num_keys, size = 0;
+    int glob = term->type == DDB_TERM_GLOB;
+    char *buf;
+
+    if (!(buf = malloc(2 * (term->key.length + 1))))
+        goto err;
+    if (!(c = acalloc(sizeof(struct ddb_cursor))))
+        goto err;
+    c->db = db;
+
+    prefix.data = buf;
+    if (glob)
+        prefix.length = glob_prefix(&term->key, buf);
+    else{
+        prefix.length = term->key.length;
+        memcpy(buf, term->key.data, prefix.length);
+    }
+    if (db->key_samples && prefix.length){
+        start = lower_bound(db, &prefix);
+        if (prefix_successor(&prefix, &buf[prefix.length], &succ))
+            end = lower_bound(db, &succ);
+    }
+    for (i = start; i < end; i++){
+        struct ddb_delta_cursor d;
+        get_item(c, i, &d);
+        if (c->entry.length < prefix.length ||
+                memcmp(c->entry.data, prefix.data, prefix.length) ||
+                (glob && !glob_match(&term->key, &c->entry)))
+            continue;
+        if (union_add(c, i, &d, &size))
+            goto err;
+    }
+    if (ddb_union_cursor_init(c, term->nnot))
+        goto err;
+    free(buf);
+    return c;
+err:
+    if (c){
+        ddb_union_cursor_free(c);
+        free(c);
+    }
+    free(buf);
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    return NULL;
+}
+
+/* The keys of a meta term are the values of its sub-query, which is
+   evaluated first, through the cache if the db has one. Each value is
+   then looked up as a key without copying it. */
+static struct ddb_cursor *meta_union(const struct ddb *db,
+                                     const struct ddb_query_term *term)
+{
+    struct ddb_cursor *c = NULL, *sub;
+    const struct ddb_entry *e;
+    uint32_t size = 0;
+    int err = 0;
+
+    if (!(sub = ddb_query_view(db, term->clauses, term->num_clauses, NULL)))
+        return NULL;
+    if (!(c = acalloc(sizeof(struct ddb_cursor))))
+        goto err;
+    c->db = db;
+    while ((e = ddb_next(sub, &err))){
+        struct ddb_delta_cursor d;
+        keyid_t id = find_key(c, e, &d);
+        if (id < db->num_keys && union_add(c, id, &d, &size))
+            goto err;
+    }
+    if (err || ddb_union_cursor_init(c, term->nnot))
+        goto err;
+    ddb_free_cursor(sub);
+    return c;
+err:
+    if (c){
+        ddb_union_cursor_free(c);
+        free(c);
+    }
+    ddb_free_cursor(sub);
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    return NULL;
+}
+
+/* A meta term of a prepared query has its sub-query evaluated and its
+   keys looked up already. */
+static struct ddb_cursor *key_ids_union(const struct ddb *db,
+                                        const struct ddb_query_term *term)
+{
+    struct ddb_cursor *c = NULL;
+    uint32_t i, size = 0;
+
+    if (!(c = acalloc(sizeof(struct ddb_cursor))))
+        goto err;
+    c->db = db;
+    for (i = 0; i < term->key.length / sizeof(keyid_t); i++){
+        struct ddb_delta_cursor d;
+        keyid_t id = term_key_id(term, i);
+        get_item(c, id, &d);
+        if (union_add(c, id, &d, &size))
+            goto err;
+    }
+    if (ddb_union_cursor_init(c, term->nnot))
+        goto err;
+    return c;
+err:
+    if (c){
+        ddb_union_cursor_free(c);
+        free(c);
+    }
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    return NULL;
+}
+
+struct ddb_cursor *ddb_values_by_id(const struct ddb *db,
+                                    const valueid_t *ids,
+                                    uint32_t num_ids)
+{
+    valueid_t *copy = NULL;
+    uint32_t i;
+
+    for (i = 0; i < num_ids; i++)
+        if (!ids[i] || ids[i] > db->num_uniq_values){
+            ddb_set_error(db, DDB_ERR_INVALID_ID);
+            return NULL;
+        }
+    if (num_ids){
+        if (!(copy = malloc(num_ids * sizeof(valueid_t)))){
+            ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+            return NULL;
+        }
+        memcpy(copy, ids, num_ids * sizeof(valueid_t));
+    }
+    return ids_cursor(db, copy, num_ids, num_ids);
+}
+
+uint32_t ddb_num_unique_values(const struct ddb *db)
+{
+    return db->num_uniq_values;
+}
+
+int ddb_value_by_id(const struct ddb *db,
+                    valueid_t id,
+                    struct ddb_entry *value,
+                    char *buf,
+                    uint64_t size)
+{
+    if (!id || id > db->num_uniq_values)
+        return DDB_ERR_INVALID_ID;
+
+    uint64_t len = db->id2value[id] - db->id2value[id - 1];
+    const char *data = &db->buf[db->id2value[id - 1]];
+
+    if (HASFLAG(db, F_COMPRESSED)){
+        /* like snprintf, length is set to the full size of the value
+           even if it doesn't fit in buf */
+        value->data = buf;
+        if (ddb_decompress(db->codebook, data, len, &value->length, buf, size))
+            return DDB_ERR_BUFFER_TOO_SMALL;
+    }else{
+        value->length = len;
+        value->data = data;
+    }
+    return 0;
+}
+
+static void *readahead_thread(void *arg)
+{
+    struct ddb_readahead *ra = (struct ddb_readahead*)arg;
+    uint32_t i;
+    for (i = 0; i < ra->num_ranges; i++)
+        madvise(ra->ranges[i].start, ra->ranges[i].len, MADV_WILLNEED);
+    return NULL;
+}
+
+static int start_readahead(struct ddb_cursor *c)
+{
+    const struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    const uint64_t psize = getpagesize();
+    struct ddb_readahead *ra;
+    uint32_t i;
+
+    if (!(ra = calloc(1, sizeof(struct ddb_readahead) +
+                         cnf->num_terms * sizeof(struct ddb_range))))
+        return -1;
+    c->readahead = ra;
+
+    for (i = 0; i < cnf->num_terms; i++){
+        const struct ddb_cursor *t = cnf->terms[i].cursor;
+        const struct ddb_delta_cursor *v = &t->cursor.value;
+        uint64_t len, num_pages, num_fetched;
+        char *p;
+
+        /* unions are read in as their lists are looked up */
+        if (!t->num_items || cnf->terms[i].next == ddb_union_next)
+            continue;
+        /* 5 bits of width, num_items deltas and the slack read_bits()
+           may touch past the end */
+        len = (5 + t->num_items * (uint64_t)v->bits + 7) / 8 + 8;
+        p = (char*)PAGE_ALIGN(v->deltas);
+        len += v->deltas - p;
+
+        num_pages = (len + psize - 1) / psize;
+        num_fetched = nonresident_bytes(p, len) / psize;
+        ra->resident_pages += num_pages - num_fetched;
+        ra->fetched_pages += num_fetched;
+        if (num_fetched){
+            ra->ranges[ra->num_ranges].start = p;
+            ra->ranges[ra->num_ranges++].len = len;
+        }
+    }
+    if (ra->num_ranges){
+        if (pthread_create(&ra->thread, NULL, readahead_thread, ra))
+            readahead_thread(ra);
+        else
+            ra->running = 1;
+    }
+    return 0;
+}
+
+int ddb_readahead_stats(const struct ddb_cursor *c,
+                        uint64_t *resident_pages,
+                        uint64_t *fetched_pages)
+{
+    if (!c->readahead)
+        return -1;
+    *resident_pages = c->readahead->resident_pages;
+    *fetched_pages = c->readahead->fetched_pages;
+    return 0;
+}
+
+struct ddb_cursor *ddb_query(const struct ddb *db,
+                             const struct ddb_query_clause *clauses,
+                             uint32_t length)
+{
+    return ddb_query_view(db, clauses, length, NULL);
+}
+
+/* Queries on values return the keys that satisfy them. Returns 1 for
+   those, 0 for queries on keys and -1 if the query mixes the two. */
+static int key_results(const struct ddb_query_clause *clauses,
+                       uint32_t num_clauses)
+{
+    uint32_t i, j, num_terms = 0, num_values = 0;
+    for (i = 0; i < num_clauses; i++)
+        for (j = 0; j < clauses[i].num_terms; j++){
+            ++num_terms;
+            if (clauses[i].terms[j].type == DDB_TERM_VALUE)
+                ++num_values;
+        }
+    if (!num_values)
+        return 0;
+    return num_values == num_terms ? 1: -1;
+}
+
+/* Opens the posting list of a term. Returns -1 with the error set if
+   it can't be opened. */
+int ddb_cnf_term_open(const struct ddb *db,
+                      struct ddb_cnf_term *term,
+                      const struct ddb_query_term *t,
+                      int keys)
+{
+    int pattern = t->type == DDB_TERM_PREFIX ||
+                  t->type == DDB_TERM_GLOB ||
+                  t->type == DDB_TERM_META ||
+                  t->type == DDB_TERM_META_IDS;
+    if (keys)
+        term->cursor = getkeys(db, &t->key);
+    else if (t->type == DDB_TERM_META)
+        term->cursor = meta_union(db, t);
+    else if (t->type == DDB_TERM_META_IDS)
+        term->cursor = key_ids_union(db, t);
+    else if (pattern)
+        term->cursor = pattern_union(db, t);
+    else if (t->type == DDB_TERM_KEY_ID)
+        term->cursor = getitem_id(db, term_key_id(t, 0));
+    else
+        term->cursor = getitem(db, &t->key);
+    if (!term->cursor)
+        return -1;
+
+    /* negated unions are complemented up front */
+    if (pattern)
+        term->next = ddb_union_next;
+    else if (t->nnot)
+        term->next = ddb_not_next;
+    else if (HASFLAG(db, F_MULTISET) && !keys)
+        /* duplicates collapse to one ID with a count */
+        term->next = ddb_multi_next;
+    else
+        term->next = ddb_val_next;
+    /* negated terms don't count towards multiplicities */
+    term->count = !t->nnot;
+    return 0;
+}
+
+static struct ddb_cursor *query_view(const struct ddb *db,
+                                     const struct ddb_query_clause *clauses,
+                                     uint32_t length,
+                                     const struct ddb_view *view,
+                                     int readahead)
+{
+    struct ddb_cursor *c = NULL;
+    int keys = key_results(clauses, length);
+
+    /* views hold value IDs, so they can't restrict keys */
+    if (keys == -1 || (keys && (view || !db->inverted))){
+        ddb_set_error(db, DDB_ERR_QUERY_NOT_SUPPORTED);
+        return NULL;
+    }
+    if (!(c = acalloc(sizeof(struct ddb_cursor)))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+
+    uint32_t j, k, i = length;
+    uint32_t num_terms = 0;
+    while (i--)
+        num_terms += clauses[i].num_terms;
+
+    c->db = db;
+    c->num_items = 0;
+    c->key_results = keys;
+
+    if (length)
+        c->next = ddb_cnf_cursor_next;
+    else{
+        c->next = empty_next;
+        return c;
+    }
+
+    c->cursor.cnf.num_clauses = length;
+    c->cursor.cnf.num_terms = num_terms;
+
+    if (!(c->cursor.cnf.clauses =
+            calloc(length + 1, sizeof(struct ddb_cnf_clause))))
+        goto err;
+    if (!(c->cursor.cnf.terms =
+            calloc(num_terms + 1, sizeof(struct ddb_cnf_term))))
+        goto err;
+
+    for (j = 0, i = 0; i < length; i++){
+        c->cursor.cnf.clauses[i].terms = &c->cursor.cnf.terms[j];
+        c->cursor.cnf.clauses[i].num_terms = clauses[i].num_terms;
+
+        for (k = 0; k < clauses[i].num_terms; k++)
+            /* the error is set by the term */
+            if (ddb_cnf_term_open(db, &c->cursor.cnf.terms[j++],
+                                  &clauses[i].terms[k], keys)){
+                ddb_free_cursor(c);
+                return NULL;
+            }
+    }
+
+    if (view){
+        struct ddb_cnf_term *term = &c->cursor.cnf.terms[j];
+        c->cursor.cnf.clauses[i].terms = term;
+        c->cursor.cnf.clauses[i].num_terms = 1;
+        if (!(term->cursor = calloc(1, sizeof(struct ddb_cursor))))
+            goto err;
+        term->cursor->cursor.view.view = view;
+        term->next = ddb_view_next;
+        ++c->cursor.cnf.num_clauses;
+        ++c->cursor.cnf.num_terms;
+    }
+
+    if (ddb_cnf_cursor_init(c))
+        goto err;
+    if (c->cursor.cnf.plan == DDB_PLAN_EMPTY)
+        return c;
+
+    /* all posting lists are known now: start reading them in before
+       the first term is advanced */
+    if (readahead && db->load_flags & DDB_LOAD_QUERY_READAHEAD &&
+            start_readahead(c))
+        goto err;
+    for (k = 0; k < c->cursor.cnf.num_terms; k++)
+        c->cursor.cnf.terms[k].next(&c->cursor.cnf.terms[k]);
+    return c;
+err:
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    ddb_free_cursor(c);
+    return NULL;
+}
+
+static struct ddb_cursor *uncached(const struct ddb *db,
+                                   const struct ddb_query_clause *clauses,
+                                   uint32_t num_clauses,
+                                   int item)
+{
+    if (item && clauses[0].terms[0].type == DDB_TERM_VALUE)
+        return getkeys(db, &clauses[0].terms[0].key);
+    if (item)
+        return getitem(db, &clauses[0].terms[0].key);
+    return query_view(db, clauses, num_clauses, NULL, 1);
+}
+
+/* Returns 1 and the IDs of the cursor if there are at most max of
+   them, 0 if there are more. */
+static int collect_ids(struct ddb_cursor *c,
+                       uint32_t max,
+                       valueid_t **ids,
+                       uint32_t *num_ids)
+{
+    uint32_t size = c->num_items ? c->num_items: MIN(64, max);
+    valueid_t id;
+    int err;
+
+    *num_ids = 0;
+    if (size > max)
+        return 0;
+    if (!(*ids = malloc((size + 1) * sizeof(valueid_t))))
+        return -1;
+    while ((id = ddb_next_id(c, &err))){
+        if (*num_ids == max){
+            free(*ids);
+            return 0;
+        }
+        if (*num_ids == size){
+            valueid_t *p;
+            size = size > max / 2 ? max: size * 2;
+            if (!(p = realloc(*ids, size * sizeof(valueid_t))))
+                break;
+            *ids = p;
+        }
+        (*ids)[(*num_ids)++] = id;
+    }
+    if (err || id){
+        free(*ids);
+        return -1;
+    }
+    return 1;
+}
+
+static struct ddb_cursor *cached(const struct ddb *db,
+                                 const struct ddb_query_clause *clauses,
+                                 uint32_t num_clauses,
+                                 int item)
+{
+    struct ddb_cursor *c = NULL;
+    valueid_t *ids = NULL;
+    uint32_t num_ids, max_ids = ddb_cache_max_ids(db->cache);
+    uint64_t key_len;
+    char *key;
+
+    if (!(key = ddb_cache_key(db, clauses, num_clauses, item, &key_len)))
+        goto err;
+    switch (ddb_cache_get(db->cache, key, key_len, &ids, &num_ids)){
+        case -1:
+            goto err;
+        case 2:
+            free(key);
+            return uncached(db, clauses, num_clauses, item);
+        case 0:
+            if (!(c = uncached(db, clauses, num_clauses, item)) ||
+                    ddb_notfound(c)){
+                free(key);
+                return c;
+            }
+            /* too large to be cached: the size is known up front for
+               single lists, the others are run again, once */
+            if (c->num_items > max_ids){
+                if (ddb_cache_put_too_large(db->cache, key, key_len))
+                    goto err;
+                free(key);
+                return c;
+            }
+            switch (collect_ids(c, max_ids, &ids, &num_ids)){
+                case -1:
+                    goto err;
+                case 0:
+                    ddb_free_cursor(c);
+                    c = NULL;
+                    if (ddb_cache_put_too_large(db->cache, key, key_len))
+                        goto err;
+                    free(key);
+                    return uncached(db, clauses, num_clauses, item);
+            }
+            ddb_free_cursor(c);
+            if (ddb_cache_put(db->cache, key, key_len, ids, num_ids)){
+                c = NULL;
+                goto err;
+            }
+    }
+    free(key);
+    if ((c = ids_cursor(db, ids, num_ids, item ? num_ids: 0)))
+        c->key_results = key_results(clauses, num_clauses) == 1;
+    return c;
+err:
+    ddb_free_cursor(c);
+    free(ids);
+    free(key);
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+    return NULL;
+}
+
+struct ddb_cursor *ddb_getitem(const struct ddb *db,
+                               const struct ddb_entry *key)
+{
+    if (db->cache){
+        struct ddb_query_term term;
+        struct ddb_query_clause clause = {&term, 1};
+        memset(&term, 0, sizeof(term));
+        term.key = *key;
+        return cached(db, &clause, 1, 1);
+    }
+    return getitem(db, key);
+}
+
+/* The keys are returned in the order of ddb_keys(). IDs of the cursor
+   are key positions + 1. */
+struct ddb_cursor *ddb_getkeys(const struct ddb *db,
+                               const struct ddb_entry *value)
+{
+    if (db->cache){
+        struct ddb_query_term term;
+        struct ddb_query_clause clause = {&term, 1};
+        memset(&term, 0, sizeof(term));
+        term.key = *value;
+        term.type = DDB_TERM_VALUE;
+        return cached(db, &clause, 1, 1);
+    }
+    return getkeys(db, value);
+}
+
+/* Queries with meta terms are not cached as a whole, only their
+   sub-queries are. */
+static int has_meta_terms(const struct ddb_query_clause *clauses,
+                          uint32_t num_clauses)
+{
+    uint32_t i, j;
+    for (i = 0; i < num_clauses; i++)
+        for (j = 0; j < clauses[i].num_terms; j++)
+            if (clauses[i].terms[j].type == DDB_TERM_META)
+                return 1;
+    return 0;
+}
+
+struct ddb_cursor *ddb_query_view(const struct ddb *db,
+                                  const struct ddb_query_clause *clauses,
+                                  uint32_t length,
+                                  const struct ddb_view *view)
+{
+    if (db->cache && length && !view && !has_meta_terms(clauses, length))
+        return cached(db, clauses, length, 0);
+    return query_view(db, clauses, length, view, 1);
+}
+
+struct ddb_cursor *ddb_query_range(const struct ddb *db,
+                                   const struct ddb_query_clause *clauses,
+                                   uint32_t num_clauses,
+                                   const struct ddb_view *view,
+                                   valueid_t start,
+                                   uint64_t end,
+                                   int readahead)
+{
+    struct ddb_cursor *c;
+    if ((c = query_view(db, clauses, num_clauses, view, readahead)) &&
+            c->next == ddb_cnf_cursor_next &&
+            c->cursor.cnf.plan != DDB_PLAN_EMPTY)
+        ddb_cnf_cursor_range(c, start, end);
+    return c;
+}
+
+/* Results of parallel queries are not cached: they are meant for
+   queries too large to be cached anyway. */
+static struct ddb_cursor *parallel_query(const struct ddb *db,
+                                         const struct ddb_query_clause *clauses,
+                                         uint32_t num_clauses,
+                                         const struct ddb_query_opts *opts)
+{
+    struct ddb_cursor *c = NULL;
+    if (!(c = acalloc(sizeof(struct ddb_cursor)))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    c->db = db;
+    c->next = ddb_parallel_cursor_next;
+    if (!(c->cursor.parallel = ddb_parallel_new(db, clauses, num_clauses,
+                                                opts))){
+        free(c);
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    return c;
+}
+
+struct ddb_cursor *ddb_query_with_opts(const struct ddb *db,
+                                       const struct ddb_query_clause *clauses,
+                                       uint32_t num_clauses,
+                                       const struct ddb_query_opts *opts)
+{
+    static const struct ddb_query_opts defaults;
+    struct ddb_cursor *c;
+
+    if (!opts)
+        opts = &defaults;
+    /* workers open their chunks after this returns, when the
+       sub-queries of meta terms may have been freed */
+    if (num_clauses && !key_results(clauses, num_clauses) &&
+            !has_meta_terms(clauses, num_clauses) &&
+            ddb_parallel_num_chunks(db, opts->num_threads) > 1)
+        return parallel_query(db, clauses, num_clauses, opts);
+    /* a limited query reads only part of its result, which is not
+       worth evaluating in full for the cache */
+    if (opts->limit)
+        c = query_view(db, clauses, num_clauses, opts->view, 1);
+    else
+        c = ddb_query_view(db, clauses, num_clauses, opts->view);
+    if (!c)
+        return NULL;
+    if (c->next == ddb_cnf_cursor_next){
+        c->cursor.cnf.offset = opts->offset;
+        if (opts->limit)
+            c->cursor.cnf.limit = opts->limit;
+    }else if (c->next == ids_cursor_next){
+        /* cached results */
+        struct ddb_ids_cursor *ids = &c->cursor.ids;
+        ids->i = MIN(opts->offset, ids->num_ids);
+        if (opts->limit && ids->num_ids - ids->i > opts->limit)
+            ids->num_ids = ids->i + opts->limit;
+    }
+    return c;
+}
+
+/* Expressions in CNF are run as clauses, so that they get the cache
+   and parallel queries. Others are evaluated by ddb_expr.c. */
+struct ddb_cursor *ddb_query_expr(const struct ddb *db,
+                                  const struct ddb_expr *expr,
+                                  const struct ddb_query_opts *opts)
+{
+    static const struct ddb_query_opts defaults;
+    struct ddb_query_clause *clauses;
+    struct ddb_cursor *c;
+    uint32_t num_clauses;
+
+    if (!opts)
+        opts = &defaults;
+    switch (ddb_expr_clauses(expr, &clauses, &num_clauses)){
+        case -1:
+            ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+            return NULL;
+        case 1:
+            c = ddb_query_with_opts(db, clauses, num_clauses, opts);
+            free(clauses);
+            return c;
+    }
+    if (!(c = acalloc(sizeof(struct ddb_cursor)))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    c->db = db;
+    c->next = ddb_expr_cursor_next;
+    /* the error is set by the expression */
+    if (ddb_expr_cursor_init(c, expr, opts->view)){
+        ddb_free_cursor(c);
+        return NULL;
+    }
+    c->cursor.expr.skip = opts->offset;
+    if (opts->limit)
+        c->cursor.expr.limit = opts->limit;
+    return c;
+}
+
+void ddb_set_cache(struct ddb *db, struct ddb_cache *cache)
+{
+    db->cache = cache;
+}
+
+int ddb_free_cursor(struct ddb_cursor *c)
+{
+    if (c){
+        int errno = c->errno;
+        if(c->next == ddb_cnf_cursor_next){
+            if (c->cursor.cnf.terms){
+                int i = c->cursor.cnf.num_terms;
+                while (i--){
+                    if (c->cursor.cnf.terms[i].next == ddb_union_next)
+                        ddb_union_cursor_free(c->cursor.cnf.terms[i].cursor);
+                    free(c->cursor.cnf.terms[i].cursor);
+                }
+            }
+            free(c->cursor.cnf.clauses);
+            free(c->cursor.cnf.terms);
+            free(c->cursor.cnf.isect);
+            free(c->cursor.cnf.counts);
+        }else if (c->next == ddb_expr_cursor_next)
+            ddb_expr_cursor_free(c);
+        else if (c->next == ids_cursor_next)
+            free(c->cursor.ids.ids);
+        else if (c->next == ddb_parallel_cursor_next)
+            ddb_parallel_free(c->cursor.parallel);
+        if (c->readahead){
+            if (c->readahead->running)
+                pthread_join(c->readahead->thread, NULL);
+            free(c->readahead);
+        }
+        free(c->decode_buf);
+        free(c->batch);
+        free(c->batch_buf);
+        free(c);
+        return errno;
+    }
+    return 0;
+}
+
+uint64_t ddb_resultset_size(const struct ddb_cursor *c)
+{
+    return c->num_items;
+}
+
+uint64_t ddb_cursor_count(struct ddb_cursor *c, int *err)
+{
+    uint64_t n = 0;
+    *err = 0;
+    if (c->next == ddb_cnf_cursor_next)
+        return ddb_cnf_cursor_count(c);
+    if (c->next == ddb_expr_cursor_next)
+        return ddb_expr_cursor_count(c);
+    if (c->next == value_cursor_next){
+        n = c->cursor.value.num_left;
+        c->cursor.value.num_left = 0;
+        return n;
+    }
+    if (c->next == ids_cursor_next){
+        n = c->cursor.ids.num_ids - c->cursor.ids.i;
+        c->cursor.ids.i = c->cursor.ids.num_ids;
+        return n;
+    }
+    c->no_valuestr = 1;
+    while (ddb_next(c, err) && !*err)
         ++n;
     return n;
 }
 
+uint64_t ddb_query_count(const struct ddb *db,
+                         const struct ddb_query_clause *clauses,
+                         uint32_t num_clauses,
+                         int *err)
+{
+    struct ddb_cursor *c;
+    uint64_t n;
+
+    /* a single key is counted by the length of its posting list,
+       unless the list may contain duplicates */
+    if (num_clauses == 1 && clauses[0].num_terms == 1 &&
+            clauses[0].terms[0].type == DDB_TERM_KEY &&
+            !HASFLAG(db, F_MULTISET)){
+        if (!(c = getitem(db, &clauses[0].terms[0].key))){
+            *err = DDB_ERR_OUT_OF_MEMORY;
+            return 0;
+        }
+        n = c->num_items;
+        ddb_free_cursor(c);
+        *err = 0;
+        return clauses[0].terms[0].nnot ? db->num_uniq_values - n: n;
+    }
+    if (!(c = query_view(db, clauses, num_clauses, NULL, 1))){
+        *err = ddb_error(db, NULL);
+        return 0;
+    }
+    n = ddb_cursor_count(c, err);
+    ddb_free_cursor(c);
+    return n;
+}
+
 int ddb_notfound(const struct ddb_cursor *c)
 {
     return c->next == empty_next;
@@ -456,11 +1857,189 @@ const struct ddb_entry *ddb_next(struct ddb_cursor *c, int *err)
     return e;
 }
 
+const struct ddb_entry *ddb_next_into(struct ddb_cursor *c,
+                                      char *buf,
+                                      uint64_t size,
+                                      int *err)
+{
+    const struct ddb_entry *e;
+    c->into_buf = buf;
+    c->into_buf_len = size;
+    e = ddb_next(c, err);
+    c->into_buf = NULL;
+    c->into_buf_len = 0;
+    return e;
+}
+
+uint32_t ddb_nextv(struct ddb_cursor *c,
+                   struct ddb_entry *entries,
+                   uint32_t num,
+                   char *buf,
+                   uint64_t size,
+                   int *err)
+{
+    const struct ddb_entry *e;
+    uint64_t offs = 0;
+    uint32_t n = 0;
+
+    *err = 0;
+    while (n < num && (e = ddb_next_into(c, &buf[offs], size - offs, err))){
+        entries[n++] = *e;
+        if (e->data == &buf[offs])
+            offs += e->length;
+        else if (e->length && e->data == c->decode_buf)
+            /* the value didn't fit in buf, so it lives in the cursor
+               and is overwritten by the next call */
+            break;
+    }
+    return n;
+}
+
+static int batch_grow(struct ddb_cursor *c, uint32_t max)
+{
+    struct ddb_batch_item *batch;
+    if (max > c->batch_len){
+        if (!(batch = realloc(c->batch, max * sizeof(struct ddb_batch_item))))
+            return -1;
+        c->batch = batch;
+        c->batch_len = max;
+    }
+    return 0;
+}
+
+static int batch_decode(struct ddb_cursor *c, struct ddb_entry *entries,
+                        uint32_t n)
+{
+    uint64_t offs = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++){
+        c->into_buf = &c->batch_buf[offs];
+        c->into_buf_len = c->batch_buf_len - offs;
+        ddb_get_valuestr(c, c->batch[i].id);
+        c->into_buf = NULL;
+        c->into_buf_len = 0;
+        if (c->errno)
+            return -1;
+
+        if (c->entry.data != &c->batch_buf[offs]){
+            /* the value didn't fit: it was decoded to decode_buf
+               instead, so grow the batch buffer and copy it over */
+            uint64_t len = 2 * (offs + c->entry.length);
+            char *buf;
+            if (!(buf = realloc(c->batch_buf, len))){
+                c->errno = DDB_ERR_OUT_OF_MEMORY;
+                return -1;
+            }
+            c->batch_buf = buf;
+            c->batch_buf_len = len;
+            memcpy(&c->batch_buf[offs], c->entry.data, c->entry.length);
+        }
+        c->batch[i].offs = offs;
+        entries[i].length = c->entry.length;
+        offs += c->entry.length;
+    }
+    /* the buffer may have moved during decoding */
+    for (i = 0; i < n; i++)
+        entries[i].data = &c->batch_buf[c->batch[i].offs];
+    return 0;
+}
+
+uint32_t ddb_next_batch(struct ddb_cursor *c,
+                        struct ddb_entry *entries,
+                        uint32_t max,
+                        int *err)
+{
+    const struct ddb *db = c->db;
+    int no_valuestr = c->no_valuestr;
+    uint32_t i, n = 0;
+
+    *err = 0;
+    if (c->next == key_cursor_next || c->next == empty_next || no_valuestr ||
+            c->key_results){
+        const struct ddb_entry *e;
+        while (n < max && (e = ddb_next(c, err)))
+            entries[n++] = *e;
+        return n;
+    }
+    if (batch_grow(c, max)){
+        *err = c->errno = DDB_ERR_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    /* decode a block of value IDs without touching the values */
+    c->no_valuestr = 1;
+    while (n < max && c->next(c) && !c->errno)
+        c->batch[n++].id = c->cur_id;
+    c->no_valuestr = no_valuestr;
+    if ((*err = c->errno))
+        return 0;
+
+    /* fetch the offsets and then the values of the whole block at
+       once, so that the random accesses overlap */
+    for (i = 0; i < n; i++)
+        PREFETCH(&db->id2value[c->batch[i].id - 1]);
+    for (i = 0; i < n; i++)
+        PREFETCH(&db->buf[db->id2value[c->batch[i].id - 1]]);
+
+    if (HASFLAG(db, F_COMPRESSED)){
+        if (batch_decode(c, entries, n))
+            n = 0;
+    }else
+        for (i = 0; i < n; i++){
+            ddb_get_valuestr(c, c->batch[i].id);
+            entries[i] = c->entry;
+        }
+    *err = c->errno;
+    return n;
+}
+
+uint32_t ddb_next_id(struct ddb_cursor *c, int *err)
+{
+    /* Only value IDs are decoded, never the values themselves. Key
+       cursors don't produce value IDs, so they return 0 right away,
+       as do exhausted cursors. */
+    int no_valuestr = c->no_valuestr;
+    valueid_t id = 0;
+
+    if (c->next != key_cursor_next){
+        c->no_valuestr = 1;
+        if (c->next(c))
+            id = c->cur_id;
+        c->no_valuestr = no_valuestr;
+    }
+    *err = c->errno;
+    return id;
+}
+
+uint32_t ddb_next_id_batch(struct ddb_cursor *c,
+                           valueid_t *ids,
+                           uint32_t max,
+                           int *err)
+{
+    uint32_t n = 0;
+    valueid_t id;
+
+    *err = 0;
+    while (n < max && (id = ddb_next_id(c, err)))
+        ids[n++] = id;
+    return n;
+}
+
 int ddb_error(const struct ddb *db, const char **errstr)
 {
+    int err = error_db == db ? error_code: 0;
     if (errstr)
-        *errstr = ERR_STR[db->errno];
-    return db->errno;
+        *errstr = ERR_STR[err];
+    return err;
+}
+
+/* Describes the error codes that cursors return. */
+const char *ddb_strerror(int err)
+{
+    if (err < 0 || err >= (int)(sizeof(ERR_STR) / sizeof(ERR_STR[0])))
+        return "Unknown error";
+    return ERR_STR[err];
 }
 
 void ddb_features(const struct ddb *db, ddb_features_t features)
@@ -478,5 +2057,6 @@ void ddb_features(const struct ddb *db, ddb_features_t features)
     features[DDB_IS_COMPRESSED] = HASFLAG(db, F_COMPRESSED);
     features[DDB_IS_HASHED] = HASFLAG(db, F_HASH);
     features[DDB_IS_MULTISET] = HASFLAG(db, F_MULTISET);
+    features[DDB_MAX_VALUE_SIZE] = db->max_value_size;
 }
 
@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <pthread.h>
+
+#include <ddb_bitmap.h>
+
+#if !defined(DDB_NO_SIMD) && defined(__GNUC__) &&\
+    (defined(__x86_64__) || defined(__i386__))
+#define DDB_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static void isect_scalar(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    while (n--)
+        dst[n] &= src[n];
+}
+
+static void unite_scalar(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    while (n--)
+        dst[n] |= src[n];
+}
+
+static int isempty_scalar(const uint64_t *b, uint32_t n)
+{
+    while (n--)
+        if (b[n])
+            return 0;
+    return 1;
+}
+
+static uint64_t count_scalar(const uint64_t *b, uint32_t n)
+{
+    uint64_t c = 0;
+    while (n--)
+        c += __builtin_popcountll(b[n]);
+    return c;
+}
+
+#ifdef DDB_X86_KERNELS
+
+__attribute__((target("popcnt")))
+static uint64_t count_popcnt(const uint64_t *b, uint32_t n)
+{
+    uint64_t c = 0;
+    while (n--)
+        c += __builtin_popcountll(b[n]);
+    return c;
+}
+
+__attribute__((target("avx2")))
+static void isect_avx2(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m256i x = _mm256_loadu_si256((const __m256i*)&dst[i]);
+        __m256i y = _mm256_loadu_si256((const __m256i*)&src[i]);
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_and_si256(x, y));
+    }
+    for (; i < n; i++)
+        dst[i] &= src[i];
+}
+
+__attribute__((target("avx2")))
+static void unite_avx2(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m256i x = _mm256_loadu_si256((const __m256i*)&dst[i]);
+        __m256i y = _mm256_loadu_si256((const __m256i*)&src[i]);
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_or_si256(x, y));
+    }
+    for (; i < n; i++)
+        dst[i] |= src[i];
+}
+
+__attribute__((target("avx2")))
+static int isempty_avx2(const uint64_t *b, uint32_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)&b[i]));
+    if (!_mm256_testz_si256(acc, acc))
+        return 0;
+    for (; i < n; i++)
+        if (b[i])
+            return 0;
+    return 1;
+}
+
+__attribute__((target("avx512f")))
+static void isect_avx512(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m512i x = _mm512_loadu_si512(&dst[i]);
+        __m512i y = _mm512_loadu_si512(&src[i]);
+        _mm512_storeu_si512(&dst[i], _mm512_and_si512(x, y));
+    }
+    for (; i < n; i++)
+        dst[i] &= src[i];
+}
+
+__attribute__((target("avx512f")))
+static void unite_avx512(uint64_t *dst, const uint64_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m512i x = _mm512_loadu_si512(&dst[i]);
+        __m512i y = _mm512_loadu_si512(&src[i]);
+        _mm512_storeu_si512(&dst[i], _mm512_or_si512(x, y));
+    }
+    for (; i < n; i++)
+        dst[i] |= src[i];
+}
+
+__attribute__((target("avx512f")))
+static int isempty_avx512(const uint64_t *b, uint32_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        acc = _mm512_or_si512(acc, _mm512_loadu_si512(&b[i]));
+    if (_mm512_test_epi64_mask(acc, acc))
+        return 0;
+    for (; i < n; i++)
+        if (b[i])
+            return 0;
+    return 1;
+}
+
+#endif /* DDB_X86_KERNELS */
+
+struct ddb_bitmap_ops ddb_bitmap = {isect_scalar, unite_scalar,
+                                    isempty_scalar, count_scalar};
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void)
+{
+#ifdef DDB_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt"))
+        ddb_bitmap.count = count_popcnt;
+    if (__builtin_cpu_supports("avx512f")){
+        ddb_bitmap.isect = isect_avx512;
+        ddb_bitmap.unite = unite_avx512;
+        ddb_bitmap.isempty = isempty_avx512;
+    }else if (__builtin_cpu_supports("avx2")){
+        ddb_bitmap.isect = isect_avx2;
+        ddb_bitmap.unite = unite_avx2;
+        ddb_bitmap.isempty = isempty_avx2;
+    }
+#endif
+}
+
+void ddb_bitmap_init(void)
+{
+    pthread_once(&init_once, select_kernels);
+}
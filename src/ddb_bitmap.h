@@ -0,0 +1,21 @@
+
+#ifndef __DDB_BITMAP_H__
+#define __DDB_BITMAP_H__
+
+#include <stdint.h>
+
+/* Word-level kernels used by the query engines. The best implementation
+   for the running CPU is picked by ddb_bitmap_init(). */
+
+struct ddb_bitmap_ops{
+    void (*isect)(uint64_t *dst, const uint64_t *src, uint32_t num_words);
+    void (*unite)(uint64_t *dst, const uint64_t *src, uint32_t num_words);
+    int (*isempty)(const uint64_t *b, uint32_t num_words);
+    uint64_t (*count)(const uint64_t *b, uint32_t num_words);
+};
+
+extern struct ddb_bitmap_ops ddb_bitmap;
+
+void ddb_bitmap_init(void);
+
+#endif /* __DDB_BITMAP_H__ */
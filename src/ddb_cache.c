@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <ddb_internal.h>
+#include <ddb_hash.h>
+#include <ddb_cache.h>
+
+/*
+ * ddb_cache maps normalized queries to their results as arrays of
+ * value IDs. Value IDs only make sense in the data they were read from,
+ * so keys start with the load ID of the db, which is unique to every
+ * ddb_loads(): a cache can be shared by many dbs, and the results of a
+ * db that is reloaded are never replayed over the new data, only left
+ * for the hand to evict.
+ *
+ * Queries whose results are too large to be cached get entries of
+ * their own, without IDs, so that they are run only once per call and
+ * not also collected in vain each time.
+ *
+ * Entries are kept in a chained hash table and in a circular list
+ * that is swept by a CLOCK hand: a hit sets the reference bit of an
+ * entry, the hand clears it and evicts entries that have not been
+ * referenced since it last passed by. */
+
+#define MIN_NUM_BUCKETS 1024
+
+struct cache_entry{
+    struct cache_entry *next;
+    struct cache_entry *clock_prev;
+    struct cache_entry *clock_next;
+    uint32_t hash;
+    uint32_t key_len;
+    uint32_t num_ids;
+    int ref;
+    int too_large;
+    valueid_t ids[];
+};
+
+struct ddb_cache{
+    pthread_mutex_t lock;
+    struct cache_entry **buckets;
+    struct cache_entry *hand;
+    uint32_t num_buckets;
+    uint64_t max_size;
+    struct ddb_cache_stats stats;
+};
+
+static uint64_t entry_size(uint32_t key_len, uint32_t num_ids)
+{
+    return sizeof(struct cache_entry) + num_ids * sizeof(valueid_t) + key_len;
+}
+
+static const char *entry_key(const struct cache_entry *e)
+{
+    return (const char*)&e->ids[e->num_ids];
+}
+
+struct ddb_cache *ddb_cache_new(uint64_t max_size)
+{
+    struct ddb_cache *cache;
+    if (!(cache = calloc(1, sizeof(struct ddb_cache))))
+        return NULL;
+    if (!(cache->buckets = calloc(MIN_NUM_BUCKETS,
+                                  sizeof(struct cache_entry*)))){
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->num_buckets = MIN_NUM_BUCKETS;
+    cache->max_size = max_size;
+    return cache;
+}
+
+void ddb_cache_free(struct ddb_cache *cache)
+{
+    if (cache){
+        uint32_t i;
+        for (i = 0; i < cache->num_buckets; i++){
+            struct cache_entry *e = cache->buckets[i];
+            while (e){
+                struct cache_entry *next = e->next;
+                free(e);
+                e = next;
+            }
+        }
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+void ddb_cache_stats(struct ddb_cache *cache, struct ddb_cache_stats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* a single result may take at most a quarter of the budget, so that
+   one large result can't flush everything else */
+uint32_t ddb_cache_max_ids(const struct ddb_cache *cache)
+{
+    uint64_t n = cache->max_size / 4 / sizeof(valueid_t);
+    return n > UINT32_MAX ? UINT32_MAX: n;
+}
+
+static int term_cmp(const void *p1, const void *p2)
+{
+    const struct ddb_query_term *x = *(const struct ddb_query_term**)p1;
+    const struct ddb_query_term *y = *(const struct ddb_query_term**)p2;
+
+    if (x->nnot != y->nnot)
+        return x->nnot - y->nnot;
+    if (x->type != y->type)
+        return x->type - y->type;
+    if (x->key.length != y->key.length)
+        return x->key.length < y->key.length ? -1: 1;
+    return memcmp(x->key.data, y->key.data, x->key.length);
+}
+
+static int entry_cmp(const void *p1, const void *p2)
+{
+    const struct ddb_entry *x = (const struct ddb_entry*)p1;
+    const struct ddb_entry *y = (const struct ddb_entry*)p2;
+
+    if (x->length != y->length)
+        return x->length < y->length ? -1: 1;
+    return memcmp(x->data, y->data, x->length);
+}
+
+static char *write_u32(char *p, uint32_t x)
+{
+    memcpy(p, &x, 4);
+    return p + 4;
+}
+
+/* Serializes the query so that queries differing only in the order
+   or repetition of clauses and terms get the same key. */
+char *ddb_cache_key(const struct ddb *db,
+                    const struct ddb_query_clause *clauses,
+                    uint32_t num_clauses,
+                    int getitem,
+                    uint64_t *length)
+{
+    const struct ddb_query_term **terms = NULL;
+    struct ddb_entry *sclauses = NULL;
+    char *tmp = NULL, *key = NULL, *p;
+    uint64_t size = 13;
+    uint32_t i, j, k, num_terms = 0;
+
+    for (i = 0; i < num_clauses; i++){
+        size += 4;
+        for (j = 0; j < clauses[i].num_terms; j++)
+            size += 5 + clauses[i].terms[j].key.length;
+        num_terms += clauses[i].num_terms;
+    }
+    if (!(terms = malloc((num_terms + 1) * sizeof(struct ddb_query_term*))))
+        goto err;
+    if (!(sclauses = malloc((num_clauses + 1) * sizeof(struct ddb_entry))))
+        goto err;
+    if (!(tmp = malloc(size)) || !(key = malloc(size)))
+        goto err;
+
+    p = tmp;
+    for (i = 0; i < num_clauses; i++){
+        const struct ddb_query_term **t = terms;
+        uint32_t n = 0;
+        for (j = 0; j < clauses[i].num_terms; j++)
+            t[j] = &clauses[i].terms[j];
+        qsort(t, clauses[i].num_terms, sizeof(struct ddb_query_term*),
+              term_cmp);
+
+        sclauses[i].data = p;
+        p += 4;
+        for (j = 0; j < clauses[i].num_terms; j++){
+            if (j && !term_cmp(&t[j], &t[j - 1]))
+                continue;
+            *p++ = (t[j]->nnot ? 1: 0) | t[j]->type << 1;
+            p = write_u32(p, t[j]->key.length);
+            memcpy(p, t[j]->key.data, t[j]->key.length);
+            p += t[j]->key.length;
+            ++n;
+        }
+        write_u32((char*)sclauses[i].data, n);
+        sclauses[i].length = p - sclauses[i].data;
+    }
+    qsort(sclauses, num_clauses, sizeof(struct ddb_entry), entry_cmp);
+
+    p = key;
+    *p++ = getitem ? 'G': 'Q';
+    memcpy(p, &db->load_id, 8);
+    p += 12;
+    for (k = 0, i = 0; i < num_clauses; i++){
+        if (i && !entry_cmp(&sclauses[i], &sclauses[i - 1]))
+            continue;
+        memcpy(p, sclauses[i].data, sclauses[i].length);
+        p += sclauses[i].length;
+        ++k;
+    }
+    write_u32(&key[9], k);
+    *length = p - key;
+
+    free(terms);
+    free(sclauses);
+    free(tmp);
+    return key;
+err:
+    free(terms);
+    free(sclauses);
+    free(tmp);
+    free(key);
+    return NULL;
+}
+
+static struct cache_entry **find_entry(struct ddb_cache *cache,
+                                       const char *key,
+                                       uint32_t key_len,
+                                       uint32_t hash)
+{
+    struct cache_entry **e = &cache->buckets[hash & (cache->num_buckets - 1)];
+    for (; *e; e = &(*e)->next)
+        if ((*e)->hash == hash && (*e)->key_len == key_len &&
+                !memcmp(entry_key(*e), key, key_len))
+            return e;
+    return e;
+}
+
+/* Returns 1 with a copy of the IDs on a hit, 2 if the result is known
+   to be too large to be cached, 0 on a miss. */
+int ddb_cache_get(struct ddb_cache *cache,
+                  const char *key,
+                  uint64_t key_len,
+                  valueid_t **ids,
+                  uint32_t *num_ids)
+{
+    uint32_t hash = SuperFastHash(key, key_len);
+    struct cache_entry *e;
+    int ret = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if ((e = *find_entry(cache, key, key_len, hash)) && e->too_large){
+        e->ref = 1;
+        ++cache->stats.misses;
+        ret = 2;
+    }else if (e){
+        *ids = NULL;
+        *num_ids = e->num_ids;
+        if (e->num_ids){
+            if (!(*ids = malloc(e->num_ids * sizeof(valueid_t)))){
+                ret = -1;
+                goto end;
+            }
+            memcpy(*ids, e->ids, e->num_ids * sizeof(valueid_t));
+        }
+        e->ref = 1;
+        ++cache->stats.hits;
+        ret = 1;
+    }else
+        ++cache->stats.misses;
+end:
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+static void evict(struct ddb_cache *cache)
+{
+    struct cache_entry *e = cache->hand;
+    while (e->ref){
+        e->ref = 0;
+        e = e->clock_next;
+    }
+    if (e->clock_next == e)
+        cache->hand = NULL;
+    else{
+        e->clock_prev->clock_next = e->clock_next;
+        e->clock_next->clock_prev = e->clock_prev;
+        cache->hand = e->clock_next;
+    }
+    *find_entry(cache, entry_key(e), e->key_len, e->hash) = e->next;
+    cache->stats.size -= entry_size(e->key_len, e->num_ids);
+    --cache->stats.num_entries;
+    ++cache->stats.evictions;
+    free(e);
+}
+
+static void rehash(struct ddb_cache *cache)
+{
+    struct cache_entry **buckets;
+    uint32_t i, num = cache->num_buckets * 2;
+
+    /* a failed rehash only makes the chains longer */
+    if (!(buckets = calloc(num, sizeof(struct cache_entry*))))
+        return;
+    for (i = 0; i < cache->num_buckets; i++){
+        struct cache_entry *e = cache->buckets[i];
+        while (e){
+            struct cache_entry *next = e->next;
+            e->next = buckets[e->hash & (num - 1)];
+            buckets[e->hash & (num - 1)] = e;
+            e = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num;
+}
+
+static int put(struct ddb_cache *cache,
+               const char *key,
+               uint64_t key_len,
+               const valueid_t *ids,
+               uint32_t num_ids,
+               int too_large)
+{
+    uint32_t hash = SuperFastHash(key, key_len);
+    uint64_t size = entry_size(key_len, num_ids);
+    struct cache_entry *e, **slot;
+    int ret = 0;
+
+    if (size > cache->max_size)
+        return 0;
+
+    pthread_mutex_lock(&cache->lock);
+    /* another thread may have added the same result meanwhile */
+    if (*find_entry(cache, key, key_len, hash))
+        goto end;
+    while (cache->stats.size + size > cache->max_size)
+        evict(cache);
+    if (!(e = malloc(size))){
+        ret = -1;
+        goto end;
+    }
+    e->hash = hash;
+    e->key_len = key_len;
+    e->num_ids = num_ids;
+    e->ref = 0;
+    e->too_large = too_large;
+    if (num_ids)
+        memcpy(e->ids, ids, num_ids * sizeof(valueid_t));
+    memcpy((char*)entry_key(e), key, key_len);
+
+    slot = find_entry(cache, key, key_len, hash);
+    e->next = *slot;
+    *slot = e;
+
+    /* new entries go right behind the hand, so they are the last
+       ones to be considered for eviction */
+    if (cache->hand){
+        e->clock_next = cache->hand;
+        e->clock_prev = cache->hand->clock_prev;
+        e->clock_prev->clock_next = e;
+        cache->hand->clock_prev = e;
+    }else
+        cache->hand = e->clock_next = e->clock_prev = e;
+
+    cache->stats.size += size;
+    if (++cache->stats.num_entries > cache->num_buckets)
+        rehash(cache);
+end:
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+int ddb_cache_put(struct ddb_cache *cache,
+                  const char *key,
+                  uint64_t key_len,
+                  const valueid_t *ids,
+                  uint32_t num_ids)
+{
+    return put(cache, key, key_len, ids, num_ids, 0);
+}
+
+int ddb_cache_put_too_large(struct ddb_cache *cache,
+                            const char *key,
+                            uint64_t key_len)
+{
+    return put(cache, key, key_len, NULL, 0, 1);
+}
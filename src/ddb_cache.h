@@ -0,0 +1,33 @@
+
+#ifndef __DDB_CACHE_H__
+#define __DDB_CACHE_H__
+
+#include <stdint.h>
+
+#include <ddb_internal.h>
+
+char *ddb_cache_key(const struct ddb *db,
+                    const struct ddb_query_clause *clauses,
+                    uint32_t num_clauses,
+                    int getitem,
+                    uint64_t *length);
+
+int ddb_cache_get(struct ddb_cache *cache,
+                  const char *key,
+                  uint64_t key_len,
+                  valueid_t **ids,
+                  uint32_t *num_ids);
+
+int ddb_cache_put(struct ddb_cache *cache,
+                  const char *key,
+                  uint64_t key_len,
+                  const valueid_t *ids,
+                  uint32_t num_ids);
+
+int ddb_cache_put_too_large(struct ddb_cache *cache,
+                            const char *key,
+                            uint64_t key_len);
+
+uint32_t ddb_cache_max_ids(const struct ddb_cache *cache);
+
+#endif /* __DDB_CACHE_H__ */
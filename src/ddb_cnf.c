@@ -1,41 +1,58 @@
-
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <discodb.h>
 #include <ddb_internal.h>
+#include <ddb_bitmap.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* a clause this many times smaller than the largest one makes merging
+   cheaper than bitmap windows */
+#define MERGE_RATIO 32
+
+/* pattern terms matching a total of one posting list entry for every
+   this many value IDs are decoded into a bitmap instead of merged */
+#define UNION_BITMAP_RATIO 64
 
-static inline void set_bit(char *b, uint32_t offset)
+static inline void set_bit(uint64_t *b, uint32_t offset)
 {
-    b[offset >> 3] |= (1 << (offset & 7));
+    b[offset >> 6] |= 1ULL << (offset & 63);
 }
 
-static inline int test_bit(const char *b, uint32_t offset)
+static inline void clear_bit(uint64_t *b, uint32_t offset)
 {
-    return b[offset >> 3] & (1 << (offset & 7));
+    b[offset >> 6] &= ~(1ULL << (offset & 63));
 }
 
-static inline void isect(char *dst, const char *src, uint32_t len)
+/* sets bits [from, to) */
+static void set_range(uint64_t *b, uint32_t from, uint32_t to)
 {
-    int i = len >> 3;
-    while (i--)
-        ((uint64_t*)dst)[i] &= ((const uint64_t*)src)[i];
+    uint32_t i = from >> 6, last = (to - 1) >> 6;
+    uint64_t head = ~0ULL << (from & 63);
+    uint64_t tail = ~0ULL >> (63 - ((to - 1) & 63));
+
+    if (i == last){
+        b[i] |= head & tail;
+        return;
+    }
+    b[i] |= head;
+    while (++i < last)
+        b[i] = ~0ULL;
+    b[last] |= tail;
 }
 
-static inline int isempty(const char *b, uint32_t len)
+#ifdef DEBUG
+static inline int test_bit(const uint64_t *b, uint32_t offset)
 {
-    int i = len >> 3;
-    while (i--)
-        if (((const uint64_t*)b)[i])
-            return 0;
-    return 1;
+    return (b[offset >> 6] >> (offset & 63)) & 1;
 }
 
-#ifdef DEBUG
-static void print_binary(const char *dst, uint32_t len)
+static void print_binary(const uint64_t *dst, uint32_t len)
 {
     int i;
-    for (i = 0; i < (len << 3); i++)
+    for (i = 0; i < len; i++)
         if (test_bit(dst, i))
             printf("1");
         else
@@ -44,11 +61,343 @@ static void print_binary(const char *dst, uint32_t len)
 }
 #endif
 
+/* the largest ID of the query, see ddb_getkeys() for queries on values */
+static inline uint32_t max_id(const struct ddb_cursor *c)
+{
+    return c->key_results ? c->db->num_keys: c->db->num_uniq_values;
+}
+
+static uint64_t term_count(const struct ddb_cnf_term *t, uint32_t num_values)
+{
+    const struct ddb_cursor *c = t->cursor;
+    if (t->next == ddb_view_next)
+        return c->cursor.view.view->num_values;
+    /* posting lists of multisets may contain duplicates, so they don't
+       tell how many IDs a negated term leaves out */
+    if (t->next == ddb_not_next)
+        return HASFLAG(c->db, F_MULTISET) || c->num_items > num_values ?
+               num_values: num_values - c->num_items;
+    return c->num_items;
+}
+
+/* Each window costs a constant amount of work on top of the bits that
+   are set in it. Dense queries use wide windows to make the constant
+   part negligible. Sparse queries use narrow ones, as every window
+   starts at a candidate ID and most of a wide window would be empty. */
+uint32_t ddb_window_size(uint64_t min_count, uint32_t num_values)
+{
+    uint32_t size = MIN_WINDOW_SIZE;
+    while (size < MAX_WINDOW_SIZE &&
+           size < min_count * MAX_WINDOW_SIZE / (num_values + 1))
+        size <<= 1;
+    return size;
+}
+
+static int clause_cmp(const void *p1, const void *p2)
+{
+    const struct ddb_cnf_clause *x = (const struct ddb_cnf_clause*)p1;
+    const struct ddb_cnf_clause *y = (const struct ddb_cnf_clause*)p2;
+
+    if (x->estimate != y->estimate)
+        return x->estimate < y->estimate ? -1: 1;
+    return x->index < y->index ? -1: 1;
+}
+
+/* The size of a clause is estimated by the sum of its posting lists.
+   Clauses are evaluated from the smallest one on, so that the rest of
+   them only need to be looked at where the small ones match. A clause
+   that can't match anything makes the whole query empty, and queries
+   with a small clause and a much larger one are merged ID by ID
+   instead of going through bitmap windows. */
+static void plan(struct ddb_cnf_cursor *cnf, uint32_t num_values)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < cnf->num_clauses; i++){
+        struct ddb_cnf_clause *clause = &cnf->clauses[i];
+        clause->index = i;
+        clause->estimate = 0;
+        for (j = 0; j < clause->num_terms; j++)
+            clause->estimate += term_count(&clause->terms[j], num_values);
+        if (clause->estimate > num_values)
+            clause->estimate = num_values;
+    }
+    qsort(cnf->clauses, cnf->num_clauses, sizeof(struct ddb_cnf_clause),
+          clause_cmp);
+
+    if (!cnf->clauses[0].estimate)
+        cnf->plan = DDB_PLAN_EMPTY;
+    else if (cnf->num_clauses > 1 &&
+             cnf->clauses[0].estimate * MERGE_RATIO <
+             cnf->clauses[cnf->num_clauses - 1].estimate)
+        cnf->plan = DDB_PLAN_MERGE;
+    else
+        cnf->plan = DDB_PLAN_BITMAP;
+}
+
+int ddb_cnf_cursor_init(struct ddb_cursor *c)
+{
+    struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    uint32_t i, num_words;
+
+    cnf->limit = UINT64_MAX;
+    cnf->end_id = max_id(c) + 1LLU;
+    plan(cnf, max_id(c));
+    for (i = 0; i < cnf->num_clauses; i++){
+        struct ddb_cnf_clause *clause = &cnf->clauses[i];
+        uint32_t j, k;
+        /* move negated terms to the front, see clause_unions() */
+        for (k = 0, j = 0; j < clause->num_terms; j++)
+            if (clause->terms[j].next == ddb_not_next){
+                struct ddb_cnf_term tmp = clause->terms[k];
+                clause->terms[k++] = clause->terms[j];
+                clause->terms[j] = tmp;
+            }
+    }
+    if (cnf->plan != DDB_PLAN_BITMAP)
+        return 0;
+
+    ddb_bitmap_init();
+    cnf->window_size = ddb_window_size(cnf->clauses[0].estimate, max_id(c));
+    num_words = cnf->window_size >> 6;
+    if (!(cnf->isect = calloc(cnf->num_clauses + 2,
+                              num_words * sizeof(uint64_t))))
+        return -1;
+    cnf->scratch = &cnf->isect[num_words];
+    for (i = 0; i < cnf->num_clauses; i++){
+        cnf->clauses[i].unionn = &cnf->isect[(i + 2) * num_words];
+        cnf->clauses[i].lo = cnf->clauses[i].hi = 0;
+    }
+    cnf->isect_offset = cnf->isect_end = 0;
+    return 0;
+}
+
+/* Multiplicities are aggregated over the positive terms that contain
+   an ID. Negated terms and views don't count. */
+static inline void add_count(const struct ddb_cnf_cursor *cnf,
+                             uint32_t *count,
+                             uint32_t n)
+{
+    if (cnf->multiplicity == DDB_MULTIPLICITY_SUM)
+        *count += n;
+    else if (!*count || n < *count)
+        *count = n;
+}
+
+/* jumps over the samples of the posting list that are below id */
+static inline void delta_skip(struct ddb_cnf_term *t, valueid_t id)
+{
+    struct ddb_cursor *c = t->cursor;
+    if (c->skips)
+        ddb_delta_cursor_skip(&c->cursor.value, c->skips, c->num_items, id);
+}
+
+/* Moves a negated term to the first ID >= id that is not in its
+   posting list. Only the posting list is stepped through, never the
+   IDs between its entries. */
+static void not_seek(struct ddb_cnf_term *t, valueid_t id)
+{
+    struct ddb_delta_cursor *v = &t->cursor->cursor.value;
+    delta_skip(t, id);
+    while (v->cur_id < id && v->num_left)
+        ddb_delta_cursor_next(v);
+    while (v->cur_id == id){
+        ++id;
+        while (v->cur_id < id && v->num_left)
+            ddb_delta_cursor_next(v);
+    }
+    if (id > max_id(t->cursor)){
+        t->empty = 1;
+        t->cur_id = 0;
+    }else
+        t->cur_id = id;
+}
+
+/* The union of a negated term in a window is the complement of its
+   posting list: set the whole range, then clear the listed IDs. */
+static void not_union(struct ddb_cnf_term *t,
+                      uint64_t *b,
+                      valueid_t base_id,
+                      valueid_t maxid,
+                      uint32_t *first,
+                      uint32_t *last)
+{
+    struct ddb_delta_cursor *v = &t->cursor->cursor.value;
+    valueid_t end = max_id(t->cursor) + 1;
+
+    if (maxid < end)
+        end = maxid;
+    *first = t->cur_id - base_id;
+    *last = end - 1 - base_id;
+    set_range(b, *first, end - base_id);
+    while (v->cur_id >= t->cur_id && v->cur_id < end){
+        clear_bit(b, v->cur_id - base_id);
+        if (!v->num_left)
+            break;
+        ddb_delta_cursor_next(v);
+    }
+    not_seek(t, end);
+}
+
+/* Array views can be searched by galloping ahead and bisecting the
+   last step. Bitmap views are indexed by ID directly. */
+static void view_seek(struct ddb_cnf_term *t, valueid_t id)
+{
+    struct ddb_view_cursor *c = &t->cursor->cursor.view;
+    const valueid_t *values = c->view->values;
+    uint32_t lo = c->index, hi, step = 1;
+
+    if (c->view->bitmap){
+        c->index = id;
+        ddb_view_next(t);
+        return;
+    }
+    while (lo + step < c->view->num_values && values[lo + step] < id){
+        lo += step;
+        step <<= 1;
+    }
+    hi = MIN(lo + step, c->view->num_values);
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (values[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    c->index = lo;
+    ddb_view_next(t);
+}
+
+static void union_sift_down(struct ddb_union_cursor *u, uint32_t i)
+{
+    struct ddb_union_list tmp = u->lists[i];
+    while (1){
+        uint32_t j = 2 * i + 1;
+        if (j >= u->num_lists)
+            break;
+        if (j + 1 < u->num_lists &&
+                u->lists[j + 1].cur.cur_id < u->lists[j].cur.cur_id)
+            ++j;
+        if (tmp.cur.cur_id <= u->lists[j].cur.cur_id)
+            break;
+        u->lists[i] = u->lists[j];
+        i = j;
+    }
+    u->lists[i] = tmp;
+}
+
+/* moves the list on top of the heap to its next ID, dropping it from
+   the heap when it runs out */
+static void union_pop(struct ddb_union_cursor *u)
+{
+    struct ddb_union_list *l = &u->lists[0];
+    if (l->cur.num_left)
+        ddb_delta_cursor_next(&l->cur);
+    else
+        *l = u->lists[--u->num_lists];
+    if (u->num_lists)
+        union_sift_down(u, 0);
+}
+
+/* Only the lists that are behind id are moved, each one jumping over
+   its skips first. */
+static void union_seek(struct ddb_cnf_term *t, valueid_t id)
+{
+    struct ddb_union_cursor *u = &t->cursor->cursor.unionn;
+
+    if (u->bitmap)
+        u->index = id;
+    else
+        while (u->num_lists && u->lists[0].cur.cur_id < id){
+            struct ddb_union_list *l = &u->lists[0];
+            if (l->skips)
+                ddb_delta_cursor_skip(&l->cur, l->skips, l->num_items, id);
+            while (l->cur.cur_id < id && l->cur.num_left)
+                ddb_delta_cursor_next(&l->cur);
+            if (l->cur.cur_id < id)
+                *l = u->lists[--u->num_lists];
+            if (u->num_lists)
+                union_sift_down(u, 0);
+        }
+    ddb_union_next(t);
+}
+
+/* The lists of the cursor are set up but not started. A negated union
+   is the complement of its bitmap. */
+int ddb_union_cursor_init(struct ddb_cursor *c, int negated)
+{
+    struct ddb_union_cursor *u = &c->cursor.unionn;
+    uint32_t i, num_words, num_values = max_id(c);
+    uint64_t total = 0;
+
+    for (i = 0; i < u->num_lists; i++)
+        total += u->lists[i].num_items;
+    c->num_items = MIN(total, num_values);
+    if (!negated && (u->num_lists < 2 ||
+                     total * UNION_BITMAP_RATIO < num_values)){
+        for (i = 0; i < u->num_lists; i++)
+            ddb_delta_cursor_next(&u->lists[i].cur);
+        for (i = u->num_lists / 2; i--;)
+            union_sift_down(u, i);
+        return 0;
+    }
+
+    u->num_bits = num_values + 1;
+    num_words = (u->num_bits + 63) >> 6;
+    if (!(u->bitmap = calloc(num_words, sizeof(uint64_t))))
+        return -1;
+    for (i = 0; i < u->num_lists; i++){
+        struct ddb_delta_cursor *v = &u->lists[i].cur;
+        while (v->num_left){
+            ddb_delta_cursor_next(v);
+            set_bit(u->bitmap, v->cur_id);
+        }
+    }
+    if (negated){
+        for (i = 0; i < num_words; i++)
+            u->bitmap[i] = ~u->bitmap[i];
+        /* IDs start from one and end at num_values */
+        clear_bit(u->bitmap, 0);
+        if (u->num_bits & 63)
+            u->bitmap[num_words - 1] &= ~0ULL >> (64 - (u->num_bits & 63));
+    }
+    ddb_bitmap_init();
+    c->num_items = ddb_bitmap.count(u->bitmap, num_words);
+    free(u->lists);
+    u->lists = NULL;
+    u->num_lists = 0;
+    return 0;
+}
+
+void ddb_union_cursor_free(struct ddb_cursor *c)
+{
+    free(c->cursor.unionn.lists);
+    free(c->cursor.unionn.bitmap);
+}
+
+/* moves a term to its first ID >= id */
+void ddb_term_seek(struct ddb_cnf_term *t, valueid_t id)
+{
+    if (t->empty || t->cur_id >= id)
+        return;
+    if (t->next == ddb_not_next)
+        not_seek(t, id);
+    else if (t->next == ddb_view_next)
+        view_seek(t, id);
+    else if (t->next == ddb_union_next)
+        union_seek(t, id);
+    else{
+        delta_skip(t, id);
+        while (t->cur_id < id && !t->empty)
+            t->next(t);
+    }
+}
+
 static int find_max_clause(struct ddb_cnf_cursor *cnf)
 {
+    uint32_t i, j;
     cnf->base_id = 0;
-    uint32_t j, i = cnf->num_clauses;
-    while (i--){
+    for (i = 0; i < cnf->num_clauses; i++){
         const struct ddb_cnf_clause *clause = &cnf->clauses[i];
         int allempty = 1;
         valueid_t cmin = DDB_MAX_NUM_VALUES;
@@ -63,74 +412,266 @@ static int find_max_clause(struct ddb_cnf_cursor *cnf)
         if (cmin > cnf->base_id)
             cnf->base_id = cmin;
     }
-    return 1;
+    return cnf->base_id < cnf->end_id;
 }
 
 static int clause_unions(struct ddb_cnf_cursor *cnf)
 {
-    uint32_t j, i = cnf->num_clauses;
-    const valueid_t maxid = cnf->base_id + WINDOW_SIZE;
-    while (i--){
+    uint32_t i, j;
+    valueid_t maxid = MIN(cnf->base_id + cnf->window_size, cnf->end_id);
+
+    cnf->lo = 0;
+    cnf->hi = cnf->window_size >> 6;
+    if (cnf->counts){
+        if (cnf->counts_hi > cnf->counts_lo)
+            memset(&cnf->counts[cnf->counts_lo << 6], 0,
+                   (cnf->counts_hi - cnf->counts_lo) * 64 * sizeof(uint32_t));
+        cnf->counts_lo = cnf->window_size >> 6;
+        cnf->counts_hi = 0;
+    }
+    for (i = 0; i < cnf->num_clauses; i++){
         struct ddb_cnf_clause *clause = &cnf->clauses[i];
-        memset(clause->unionn, 0, WINDOW_SIZE_BYTES);
+        /* only the words set in the previous window need clearing */
+        memset(&clause->unionn[clause->lo], 0,
+               (clause->hi - clause->lo) * sizeof(uint64_t));
+        clause->lo = cnf->window_size >> 6;
+        clause->hi = 0;
         int allempty = 1;
+        uint32_t num_nots = 0;
         for (j = 0; j < clause->num_terms; j++){
             struct ddb_cnf_term *t = &clause->terms[j];
             if (!t->empty){
+                uint32_t first, last = 0;
                 allempty = 0;
-                while (t->cur_id < cnf->base_id && !t->empty)
-                    t->next(t);
-                while (t->cur_id < maxid && !t->empty){
-                    set_bit(clause->unionn, t->cur_id - cnf->base_id);
-                    t->next(t);
+                ddb_term_seek(t, cnf->base_id);
+                if (t->cur_id >= maxid || t->empty)
+                    continue;
+                if (t->next == ddb_not_next){
+                    /* negated terms come first in a clause, so the
+                       first one can clear bits in the union directly.
+                       The others are built separately and or'ed in. */
+                    if (!num_nots++)
+                        not_union(t, clause->unionn, cnf->base_id, maxid,
+                                  &first, &last);
+                    else{
+                        uint32_t k;
+                        not_union(t, cnf->scratch, cnf->base_id, maxid,
+                                  &first, &last);
+                        for (k = first >> 6; k <= last >> 6; k++){
+                            clause->unionn[k] |= cnf->scratch[k];
+                            cnf->scratch[k] = 0;
+                        }
+                    }
+                }else{
+                    first = t->cur_id - cnf->base_id;
+                    while (t->cur_id < maxid && !t->empty){
+                        last = t->cur_id - cnf->base_id;
+                        set_bit(clause->unionn, last);
+                        if (cnf->counts && t->count)
+                            add_count(cnf, &cnf->counts[last], t->count);
+                        t->next(t);
+                    }
                 }
+                if ((first >> 6) < clause->lo)
+                    clause->lo = first >> 6;
+                if ((last >> 6) + 1 > clause->hi)
+                    clause->hi = (last >> 6) + 1;
             }
         }
+        if (clause->hi < clause->lo)
+            clause->lo = clause->hi = 0;
 #ifdef DEBUG
-        printf("dbg UNION[%u] ", i);
-        print_binary(clause->unionn, WINDOW_SIZE_BYTES);
+        printf("dbg UNION[%u] ", clause->index);
+        print_binary(clause->unionn, cnf->window_size);
 #endif
         if (allempty)
             return 0;
+        if (clause->lo < clause->hi){
+            if (clause->lo < cnf->counts_lo)
+                cnf->counts_lo = clause->lo;
+            if (clause->hi > cnf->counts_hi)
+                cnf->counts_hi = clause->hi;
+        }
+        /* the remaining clauses are needed only in the range where all
+           the previous ones have bits set */
+        if (clause->lo > cnf->lo)
+            cnf->lo = clause->lo;
+        if (clause->hi < cnf->hi)
+            cnf->hi = clause->hi;
+        if (cnf->lo >= cnf->hi)
+            return 1;
+        maxid = MIN(cnf->base_id + (cnf->hi << 6), cnf->end_id);
     }
     return 1;
 }
 
 static int intersect_clauses(struct ddb_cnf_cursor *cnf)
 {
-    if (!cnf->num_clauses)
+    uint32_t i, lo = cnf->lo, hi = cnf->hi;
+
+    cnf->isect_offset = cnf->isect_end = 0;
+    if (lo >= hi)
         return 1;
 
-    cnf->isect_offset = 0;
-    memcpy(cnf->isect, cnf->clauses[0].unionn, WINDOW_SIZE_BYTES);
-    int i;
+    memcpy(&cnf->isect[lo], &cnf->clauses[0].unionn[lo],
+           (hi - lo) * sizeof(uint64_t));
     for (i = 1; i < cnf->num_clauses; i++){
-        isect(cnf->isect, cnf->clauses[i].unionn, WINDOW_SIZE_BYTES);
+        ddb_bitmap.isect(&cnf->isect[lo], &cnf->clauses[i].unionn[lo], hi - lo);
 #ifdef DEBUG
         printf("dbg ISECT[%u] ", i);
-        print_binary(cnf->isect, WINDOW_SIZE_BYTES);
+        print_binary(cnf->isect, cnf->window_size);
 #endif
     }
-    return isempty(cnf->isect, WINDOW_SIZE_BYTES);
+    if (ddb_bitmap.isempty(&cnf->isect[lo], hi - lo))
+        return 1;
+    cnf->isect_offset = lo << 6;
+    cnf->isect_end = hi << 6;
+    return 0;
+}
+
+/* returns the smallest ID >= id in the clause, 0 if there is none */
+static valueid_t clause_seek(struct ddb_cnf_clause *clause, valueid_t id)
+{
+    valueid_t min = 0;
+    uint32_t j;
+    for (j = 0; j < clause->num_terms; j++){
+        struct ddb_cnf_term *t = &clause->terms[j];
+        ddb_term_seek(t, id);
+        if (!t->empty && (!min || t->cur_id < min))
+            min = t->cur_id;
+    }
+    return min;
+}
+
+/* Leapfrog intersection: each clause in turn moves the candidate ID
+   to its next ID at or above it, until all the clauses agree on one.
+   base_id is the next candidate. */
+static valueid_t merge_next(struct ddb_cnf_cursor *cnf)
+{
+    valueid_t id = cnf->base_id;
+    uint32_t i = 0, num_matched = 0;
+
+    while (num_matched < cnf->num_clauses){
+        valueid_t min = clause_seek(&cnf->clauses[i], id);
+        if (!min || min >= cnf->end_id)
+            return 0;
+        if (min == id)
+            ++num_matched;
+        else{
+            id = min;
+            num_matched = 1;
+        }
+        if (++i == cnf->num_clauses)
+            i = 0;
+    }
+    cnf->base_id = id + 1;
+    return id;
+}
+
+static uint32_t merge_multiplicity(const struct ddb_cnf_cursor *cnf,
+                                   valueid_t id)
+{
+    uint32_t i, n = 0;
+    for (i = 0; i < cnf->num_terms; i++){
+        const struct ddb_cnf_term *t = &cnf->terms[i];
+        if (!t->empty && t->cur_id == id && t->count)
+            add_count(cnf, &n, t->count);
+    }
+    return n;
 }
 
 static const struct ddb_entry *next_isect_entry(struct ddb_cursor *c)
 {
     struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
-    for(; cnf->isect_offset < WINDOW_SIZE; cnf->isect_offset++)
-        if (test_bit(cnf->isect, cnf->isect_offset)){
-            if (ddb_get_valuestr(c, cnf->base_id + cnf->isect_offset))
+    while (cnf->isect_offset < cnf->isect_end){
+        uint64_t w = cnf->isect[cnf->isect_offset >> 6] >>
+                     (cnf->isect_offset & 63);
+        if (w){
+            cnf->isect_offset += __builtin_ctzll(w);
+            if (cnf->counts)
+                c->multiplicity = cnf->counts[cnf->isect_offset];
+            if (ddb_get_valuestr(c, cnf->base_id + cnf->isect_offset++))
                 return NULL;
-            ++cnf->isect_offset;
             return &c->entry;
         }
+        cnf->isect_offset = (cnf->isect_offset | 63) + 1;
+    }
     return NULL;
 }
 
-const struct ddb_entry *ddb_cnf_cursor_next(struct ddb_cursor *c)
+/* counts the bits left in the current window */
+static uint64_t count_isect(struct ddb_cnf_cursor *cnf)
+{
+    uint32_t offset = cnf->isect_offset;
+    uint64_t n = 0;
+
+    if (offset >= cnf->isect_end)
+        return 0;
+    if (offset & 63){
+        n = __builtin_popcountll(cnf->isect[offset >> 6] >> (offset & 63));
+        offset = (offset | 63) + 1;
+    }
+    return n + ddb_bitmap.count(&cnf->isect[offset >> 6],
+                                (cnf->isect_end - offset) >> 6);
+}
+
+/* skips n of the bits left in the current window, n < count_isect() */
+static void skip_isect(struct ddb_cnf_cursor *cnf, uint64_t n)
+{
+    uint32_t offset = cnf->isect_offset;
+    uint64_t w = cnf->isect[offset >> 6] & (~0ULL << (offset & 63));
+    uint32_t k;
+
+    while ((k = __builtin_popcountll(w)) <= n){
+        n -= k;
+        offset = (offset | 63) + 1;
+        w = cnf->isect[offset >> 6];
+    }
+    while (n--)
+        w &= w - 1;
+    cnf->isect_offset = (offset & ~63) + __builtin_ctzll(w);
+}
+
+/* Skips the offset without decoding any values. Bitmap windows are
+   skipped as a whole when their popcount doesn't reach the offset. */
+static void skip_offset(struct ddb_cnf_cursor *cnf)
+{
+    if (cnf->plan == DDB_PLAN_MERGE)
+        while (cnf->offset && merge_next(cnf))
+            --cnf->offset;
+    else if (cnf->plan == DDB_PLAN_BITMAP)
+        while (1){
+            uint64_t n = count_isect(cnf);
+            if (n > cnf->offset){
+                skip_isect(cnf, cnf->offset);
+                break;
+            }
+            cnf->offset -= n;
+            cnf->isect_offset = cnf->isect_end;
+            if (!cnf->offset || !find_max_clause(cnf) || !clause_unions(cnf))
+                break;
+            intersect_clauses(cnf);
+        }
+    cnf->offset = 0;
+}
+
+static const struct ddb_entry *cnf_next(struct ddb_cursor *c)
 {
     struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
     const struct ddb_entry *e;
+    valueid_t id;
+
+    if (cnf->plan == DDB_PLAN_EMPTY)
+        return NULL;
+    if (cnf->plan == DDB_PLAN_MERGE){
+        if (!(id = merge_next(cnf)))
+            return NULL;
+        if (cnf->multiplicity)
+            c->multiplicity = merge_multiplicity(cnf, id);
+        if (ddb_get_valuestr(c, id))
+            return NULL;
+        return &c->entry;
+    }
     if ((e = next_isect_entry(c)))
         return e;
 
@@ -151,23 +692,62 @@ const struct ddb_entry *ddb_cnf_cursor_next(struct ddb_cursor *c)
     }
 }
 
+const struct ddb_entry *ddb_cnf_cursor_next(struct ddb_cursor *c)
+{
+    struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    const struct ddb_entry *e;
+
+    if (!cnf->limit)
+        return NULL;
+    if (cnf->offset)
+        skip_offset(cnf);
+    if ((e = cnf_next(c)))
+        --cnf->limit;
+    return e;
+}
+
+uint64_t ddb_cnf_cursor_count(struct ddb_cursor *c)
+{
+    struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    uint64_t n = 0;
+
+    if (cnf->plan == DDB_PLAN_EMPTY || !cnf->limit)
+        return 0;
+    if (cnf->offset)
+        skip_offset(cnf);
+    if (cnf->plan == DDB_PLAN_MERGE)
+        while (n < cnf->limit && merge_next(cnf))
+            ++n;
+    else{
+        n = count_isect(cnf);
+        while (n < cnf->limit && find_max_clause(cnf) && clause_unions(cnf))
+            if (!intersect_clauses(cnf))
+                n += count_isect(cnf);
+        cnf->isect_offset = cnf->isect_end = 0;
+        n = MIN(n, cnf->limit);
+    }
+    cnf->limit -= n;
+    return n;
+}
+
+/* Restricts the cursor to the IDs in [start, end). The terms must
+   not have been moved past start yet. */
+void ddb_cnf_cursor_range(struct ddb_cursor *c, valueid_t start, uint64_t end)
+{
+    struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    uint32_t i;
+
+    cnf->end_id = MIN(end, cnf->end_id);
+    cnf->base_id = start;
+    for (i = 0; i < cnf->num_terms; i++)
+        ddb_term_seek(&cnf->terms[i], start);
+}
+
 valueid_t ddb_not_next(struct ddb_cnf_term *t)
 {
-    struct ddb_delta_cursor *v = &t->cursor->cursor.value;
     if (t->empty)
         return 0;
-    if (!t->cur_id++ && v->num_left)
-        /* first step */
-        ddb_delta_cursor_next(v);
-    while (t->cur_id == v->cur_id){
-        ++t->cur_id;
-        if (v->num_left)
-            ddb_delta_cursor_next(v);
-    }
-    if (t->cur_id >= t->cursor->db->num_uniq_values + 1){
-        t->empty = 1;
-        t->cur_id = 0;
-    }
+    not_seek(t, t->cur_id + 1);
     return t->cur_id;
 }
 
@@ -186,11 +766,20 @@ valueid_t ddb_val_next(struct ddb_cnf_term *t)
     }
 }
 
-valueid_t ddb_view_next(struct ddb_cnf_term *t)
+valueid_t ddb_multi_next(struct ddb_cnf_term *t)
 {
-    struct ddb_view_cursor *c = &t->cursor->cursor.view;
-    if (c->index < c->view->num_values){
-        t->cur_id = c->view->values[c->index++];
+    struct ddb_delta_cursor *v = &t->cursor->cursor.value;
+    if (t->empty)
+        return 0;
+    else if (v->num_left){
+        ddb_delta_cursor_next(v);
+        t->count = 1;
+        /* repeated IDs have zero deltas */
+        while (v->num_left && !ddb_delta_cursor_peek(v)){
+            ddb_delta_cursor_next(v);
+            ++t->count;
+        }
+        t->cur_id = v->cur_id;
         return t->cur_id;
     }else{
         t->empty = 1;
@@ -198,3 +787,98 @@ valueid_t ddb_view_next(struct ddb_cnf_term *t)
         return 0;
     }
 }
+
+valueid_t ddb_view_next(struct ddb_cnf_term *t)
+{
+    struct ddb_view_cursor *c = &t->cursor->cursor.view;
+    const struct ddb_view *view = c->view;
+    if (view->bitmap){
+        /* index is the next ID to look at */
+        while (c->index < view->num_bits){
+            uint64_t w = view->bitmap[c->index >> 6] >> (c->index & 63);
+            if (w){
+                t->cur_id = c->index + __builtin_ctzll(w);
+                c->index = t->cur_id + 1;
+                return t->cur_id;
+            }
+            c->index = (c->index | 63) + 1;
+        }
+    }else if (c->index < view->num_values){
+        t->cur_id = view->values[c->index++];
+        return t->cur_id;
+    }
+    t->empty = 1;
+    t->cur_id = 0;
+    return 0;
+}
+
+/* A pattern term counts once towards multiplicities, however many of
+   its lists contain an ID. */
+valueid_t ddb_union_next(struct ddb_cnf_term *t)
+{
+    struct ddb_union_cursor *u = &t->cursor->cursor.unionn;
+    if (u->bitmap){
+        while (u->index < u->num_bits){
+            uint64_t w = u->bitmap[u->index >> 6] >> (u->index & 63);
+            if (w){
+                t->cur_id = u->index + __builtin_ctzll(w);
+                u->index = t->cur_id + 1;
+                return t->cur_id;
+            }
+            u->index = (u->index | 63) + 1;
+        }
+    }else if (u->num_lists){
+        t->cur_id = u->lists[0].cur.cur_id;
+        while (u->num_lists && u->lists[0].cur.cur_id == t->cur_id)
+            union_pop(u);
+        return t->cur_id;
+    }
+    t->empty = 1;
+    t->cur_id = 0;
+    return 0;
+}
+
+int ddb_query_plan(const struct ddb_cursor *c, char *buf, uint64_t size)
+{
+    static const char *names[] = {"empty", "bitmap", "merge"};
+    const struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+    uint64_t n;
+    uint32_t i;
+
+    if (c->next != ddb_cnf_cursor_next)
+        return -1;
+    if (!buf || !size)
+        return cnf->plan;
+
+    n = snprintf(buf, size, "%s", names[cnf->plan]);
+    if (cnf->plan == DDB_PLAN_BITMAP && n < size)
+        n += snprintf(&buf[n], size - n, " window=%u", cnf->window_size);
+    /* clauses in the order of evaluation, as index:estimate */
+    for (i = 0; i < cnf->num_clauses && n < size; i++)
+        n += snprintf(&buf[n], size - n, "%s%u:%llu", i ? " ": " clauses=",
+                      cnf->clauses[i].index,
+                      (long long unsigned int)cnf->clauses[i].estimate);
+    return cnf->plan;
+}
+
+int ddb_cursor_multiplicity(struct ddb_cursor *c, int mode)
+{
+    struct ddb_cnf_cursor *cnf = &c->cursor.cnf;
+
+    if (c->next != ddb_cnf_cursor_next)
+        return -1;
+    if (!mode){
+        free(cnf->counts);
+        cnf->counts = NULL;
+        c->multiplicity = 0;
+    }else if (cnf->plan == DDB_PLAN_BITMAP && !cnf->counts &&
+            !(cnf->counts = calloc(cnf->window_size, sizeof(uint32_t))))
+        return -1;
+    cnf->multiplicity = mode;
+    return 0;
+}
+
+uint32_t ddb_multiplicity(const struct ddb_cursor *c)
+{
+    return c->multiplicity ? c->multiplicity: 1;
+}
@@ -179,6 +179,140 @@ end:
     return ret;
 }
 
+/* Samples every SKIP_INTERVAL'th ID of the posting lists written by
+   pack_key2values(), see ddb_delta_cursor_skip(). */
+static int pack_skips(struct ddb_packed *pack)
+{
+    const uint64_t toc = pack->head->key2values_offs;
+    valueid_t *skips = NULL;
+    uint32_t i, size = 0;
+    uint32_t num = pack->head->num_keys;
+    int ret = -1;
+
+    if (buffer_new_section(pack, num + 1))
+        goto end;
+
+    for (i = 0; i < num; i++){
+        struct ddb_delta_cursor c;
+        uint32_t j, num_skips;
+        uint64_t offs;
+        const char *p;
+
+        memcpy(&offs, &pack->buffer[toc + i * 8], 8);
+        p = &pack->buffer[offs];
+        ddb_delta_cursor(&c, &p[4 + *(uint32_t*)p]);
+        num_skips = ddb_delta_num_skips(c.num_left);
+        if (num_skips > size){
+            free(skips);
+            size = num_skips;
+            if (!(skips = malloc(size * sizeof(valueid_t))))
+                goto end;
+        }
+        for (j = 0; j < num_skips * SKIP_INTERVAL; j++){
+            ddb_delta_cursor_next(&c);
+            if (!((j + 1) % SKIP_INTERVAL))
+                skips[j / SKIP_INTERVAL] = c.cur_id;
+        }
+
+        buffer_toc_mark(pack);
+        if (num_skips && buffer_write_data(pack, (const char*)skips,
+                                           num_skips * sizeof(valueid_t)))
+            goto end;
+    }
+    buffer_toc_mark(pack);
+    SETFLAG(pack->head, F_SKIPS);
+    ret = 0;
+end:
+    free(skips);
+    return ret;
+}
+
+/* Transposes the posting lists written by pack_key2values(): for each
+   value, the keys it is found under as key IDs + 1, delta-encoded the
+   same way. The lists are filled from the last key to the first, so
+   they come out sorted, and each value's start ends up in starts. */
+static int pack_inverted(struct ddb_packed *pack)
+{
+    const uint64_t toc = pack->head->key2values_offs;
+    uint32_t num_keys = pack->head->num_keys;
+    uint32_t num_values = pack->head->num_uniq_values;
+    uint64_t *starts = NULL;
+    valueid_t *keys = NULL;
+    char *dbuf = NULL;
+    uint64_t dbuf_size = 0;
+    uint32_t i, v;
+    int ret = -1;
+
+    if (!(starts = calloc(num_values + 2, sizeof(uint64_t))))
+        goto end;
+    for (i = 0; i < num_keys; i++){
+        struct ddb_delta_cursor c;
+        uint64_t offs;
+        const char *p;
+
+        memcpy(&offs, &pack->buffer[toc + i * 8], 8);
+        p = &pack->buffer[offs];
+        ddb_delta_cursor(&c, &p[4 + *(uint32_t*)p]);
+        while (c.num_left){
+            ddb_delta_cursor_next(&c);
+            /* duplicates of multisets have zero deltas */
+            if (c.num_left && !ddb_delta_cursor_peek(&c))
+                continue;
+            ++starts[c.cur_id];
+        }
+    }
+    for (v = 1; v <= num_values + 1; v++)
+        starts[v] += starts[v - 1];
+    if (!(keys = malloc((starts[num_values] + 1) * sizeof(valueid_t))))
+        goto end;
+
+    i = num_keys;
+    while (i--){
+        struct ddb_delta_cursor c;
+        uint64_t offs;
+        const char *p;
+
+        memcpy(&offs, &pack->buffer[toc + i * 8], 8);
+        p = &pack->buffer[offs];
+        ddb_delta_cursor(&c, &p[4 + *(uint32_t*)p]);
+        while (c.num_left){
+            ddb_delta_cursor_next(&c);
+            if (c.num_left && !ddb_delta_cursor_peek(&c))
+                continue;
+            keys[--starts[c.cur_id]] = i + 1;
+        }
+    }
+
+    if (buffer_new_section(pack, num_values + 1))
+        goto end;
+    for (v = 1; v <= num_values; v++){
+        uint64_t size;
+        uint32_t num_written;
+        int duplicates;
+
+        if (ddb_delta_encode(&keys[starts[v]],
+                             starts[v + 1] - starts[v],
+                             &dbuf,
+                             &dbuf_size,
+                             &size,
+                             &num_written,
+                             &duplicates,
+                             1))
+            goto end;
+        buffer_toc_mark(pack);
+        if (buffer_write_data(pack, dbuf, size))
+            goto end;
+    }
+    buffer_toc_mark(pack);
+    SETFLAG(pack->head, F_INVERTED);
+    ret = 0;
+end:
+    free(starts);
+    free(keys);
+    free(dbuf);
+    return ret;
+}
+
 #ifdef HUFFMAN_DEBUG
 static int ccmp(const char *x, const char *y, uint32_t len)
 {
@@ -220,6 +354,10 @@ static int pack_id2value(struct ddb_packed *pack,
     if (!(c = ddb_map_cursor_new(values_map)))
         goto end;
 
+    /* max_value_size is reported as DDB_MAX_VALUE_SIZE, for callers
+       to size the buffers they pass to ddb_next_into() */
+    SETFLAG(pack->head, F_MAXVALUE);
+
     #ifdef HUFFMAN_DEBUG
     uint32_t dsize;
     char *dbuf = NULL;
@@ -227,6 +365,8 @@ static int pack_id2value(struct ddb_packed *pack,
     #endif
 
     while (ddb_map_next_str(c, &key)){
+        if (key.length > pack->head->max_value_size)
+            pack->head->max_value_size = key.length;
         if (disable_compr){
             val = key.data;
             size = key.length;
@@ -236,8 +376,12 @@ static int pack_id2value(struct ddb_packed *pack,
                 goto end;
             val = buf;
             #ifdef HUFFMAN_DEBUG
-            ddb_decompress(pack->codebook, buf, size,
-                &dsize, &dbuf, &dbuf_len);
+            if (ddb_decompress(pack->codebook, buf, size,
+                    &dsize, dbuf, dbuf_len)){
+                dbuf = realloc(dbuf, dbuf_len = dsize);
+                ddb_decompress(pack->codebook, buf, size,
+                    &dsize, dbuf, dbuf_len);
+            }
             if (dsize != key.length || ccmp(dbuf, key.data, dsize)){
                 fprintf(stderr, "ORIG: <%.*s> DECOMP: <%.*s> (%u and %u)\n",
                     key.length, key.data, dsize, dbuf, dsize, key.length);
@@ -269,6 +413,53 @@ end:
     return err;
 }
 
+/* A minimal perfect hash over the values followed by the value ID of
+   each hash slot, see ddb_value_id(). */
+static int pack_value_index(struct ddb_packed *pack,
+                            const struct ddb_map *values_map)
+{
+    const uint64_t zero = 0;
+    uint32_t n = ddb_map_num_items(values_map);
+    uint32_t hash_size = 0;
+    struct ddb_map_cursor *c = NULL;
+    valueid_t *index = NULL;
+    struct ddb_entry value;
+    char *hash = NULL;
+    uint64_t size;
+    uintptr_t *id;
+    int err = -1;
+
+    if (!(hash = ddb_build_cmph(values_map, &hash_size)))
+        goto end;
+    if (!(index = malloc(n * sizeof(valueid_t))))
+        goto end;
+    if (!(c = ddb_map_cursor_new(values_map)))
+        goto end;
+    while (ddb_map_next_item_str(c, &value, &id))
+        index[cmph_search_packed(hash, value.data, value.length)] = *id;
+
+    /* the hash is read in place, keep it aligned */
+    if (buffer_write_data(pack, (const char*)&zero, (8 - (pack->offs & 7)) & 7))
+        goto end;
+    pack->head->value_index_offs = pack->offs;
+    size = hash_size;
+    if (buffer_write_data(pack, (const char*)&size, 8))
+        goto end;
+    if (buffer_write_data(pack, hash, hash_size))
+        goto end;
+    if (buffer_write_data(pack, (const char*)&zero, (8 - (hash_size & 7)) & 7))
+        goto end;
+    if (buffer_write_data(pack, (const char*)index, n * sizeof(valueid_t)))
+        goto end;
+    SETFLAG(pack->head, F_VALUE_INDEX);
+    err = 0;
+end:
+    ddb_map_cursor_free(c);
+    free(index);
+    free(hash);
+    return err;
+}
+
 static int pack_codebook(struct ddb_packed *pack)
 {
     buffer_new_section(pack, 0);
@@ -317,6 +508,80 @@ end:
     return order;
 }
 
+struct sorted_key{
+    struct ddb_entry key;
+    keyid_t slot;
+};
+
+static int sorted_key_cmp(const void *p1, const void *p2)
+{
+    const struct ddb_entry *x = &((const struct sorted_key*)p1)->key;
+    const struct ddb_entry *y = &((const struct sorted_key*)p2)->key;
+    int c = memcmp(x->data, y->data, x->length < y->length ?
+                                     x->length: y->length);
+    if (c)
+        return c;
+    return x->length < y->length ? -1: x->length > y->length;
+}
+
+/* Puts the keys in lexicographic order. The hash maps each key to its
+   slot in the original order, so the new position of each slot is
+   returned as a rank table for pack_key_index(). */
+static keyid_t *sort_keys(struct ddb_packed *pack, struct ddb_entry *order)
+{
+    uint32_t i, num = pack->head->num_keys;
+    struct sorted_key *keys;
+    keyid_t *rank;
+
+    if (!(rank = malloc((num + 1) * sizeof(keyid_t))))
+        return NULL;
+    if (!(keys = malloc((num + 1) * sizeof(struct sorted_key)))){
+        free(rank);
+        return NULL;
+    }
+    for (i = 0; i < num; i++){
+        keys[i].key = order[i];
+        keys[i].slot = i;
+    }
+    qsort(keys, num, sizeof(struct sorted_key), sorted_key_cmp);
+    for (i = 0; i < num; i++){
+        order[i] = keys[i].key;
+        rank[keys[i].slot] = i;
+    }
+    free(keys);
+    return rank;
+}
+
+/* The rank table, if the keys are hashed, followed by a copy of every
+   KEY_SAMPLE_INTERVAL'th key, which key searches bisect before reading
+   through the keys in order. */
+static int pack_key_index(struct ddb_packed *pack,
+                          const struct ddb_entry *keys,
+                          const keyid_t *rank)
+{
+    uint32_t i, num = pack->head->num_keys;
+
+    if (HASFLAG(pack->head, F_HASH)){
+        pack->head->rank_offs = pack->offs;
+        if (buffer_write_data(pack, (const char*)rank, num * sizeof(keyid_t)))
+            return -1;
+    }
+    pack->head->key_samples_offs = pack->offs;
+    if (buffer_new_section(pack, (num + KEY_SAMPLE_INTERVAL - 1) /
+                                 KEY_SAMPLE_INTERVAL + 1))
+        return -1;
+    for (i = 0; i < num; i += KEY_SAMPLE_INTERVAL){
+        buffer_toc_mark(pack);
+        if (buffer_write_data(pack, keys[i].data, keys[i].length))
+            return -1;
+    }
+    buffer_toc_mark(pack);
+    SETFLAG(pack->head, F_SORTED);
+    if (HASFLAG(pack->head, F_HASH))
+        pack->head->magic = DISCODB_MAGIC_SORTED;
+    return 0;
+}
+
 static int pack_header(struct ddb_packed *pack, const struct ddb_cons *cons)
 {
     struct ddb_header *head = pack->head;
@@ -353,6 +618,7 @@ char *ddb_cons_finalize(struct ddb_cons *cons, uint64_t *length, uint64_t flags)
 {
     struct ddb_packed *pack = NULL;
     struct ddb_entry *order = NULL;
+    keyid_t *rank = NULL;
     char *buf = NULL;
     int disable_compression, err = 1;
     DDB_TIMER_DEF
@@ -373,6 +639,13 @@ char *ddb_cons_finalize(struct ddb_cons *cons, uint64_t *length, uint64_t flags)
         goto err;
     DDB_TIMER_END("hash")
 
+    if (flags & DDB_OPT_SORTED_KEYS){
+        DDB_TIMER_START
+        if (!(rank = sort_keys(pack, order)))
+            goto err;
+        DDB_TIMER_END("sort_keys")
+    }
+
     DDB_TIMER_START
     pack->head->key2values_offs = pack->offs;
     if (pack_key2values(pack, order, cons->keys_map,
@@ -380,18 +653,48 @@ char *ddb_cons_finalize(struct ddb_cons *cons, uint64_t *length, uint64_t flags)
         goto err;
     DDB_TIMER_END("key2values")
 
+    if (flags & DDB_OPT_SKIPS){
+        DDB_TIMER_START
+        pack->head->skips_offs = pack->offs;
+        if (pack_skips(pack))
+            goto err;
+        DDB_TIMER_END("skips")
+    }
+
+    if (flags & DDB_OPT_SORTED_KEYS){
+        DDB_TIMER_START
+        if (pack_key_index(pack, order, rank))
+            goto err;
+        DDB_TIMER_END("key_index")
+    }
+
+    if (flags & DDB_OPT_INVERTED){
+        DDB_TIMER_START
+        pack->head->inverted_offs = pack->offs;
+        if (pack_inverted(pack))
+            goto err;
+        DDB_TIMER_END("inverted")
+    }
+
     DDB_TIMER_START
     flags |= maybe_disable_compression(cons);
     disable_compression = flags & DDB_OPT_DISABLE_COMPRESSION;
     pack->head->id2value_offs = pack->offs;
     if (pack_id2value(pack, cons->values_map, disable_compression))
         goto err;
-    else{
-        ddb_map_free(cons->values_map);
-        cons->values_map = NULL;
-    }
     DDB_TIMER_END("id2values")
 
+    /* few values are found quickly enough by scanning them */
+    if (flags & DDB_OPT_VALUE_INDEX &&
+            pack->head->num_uniq_values > DDB_HASH_MIN_KEYS){
+        DDB_TIMER_START
+        if (pack_value_index(pack, cons->values_map))
+            goto err;
+        DDB_TIMER_END("value_index")
+    }
+    ddb_map_free(cons->values_map);
+    cons->values_map = NULL;
+
     if (!disable_compression){
         DDB_TIMER_START
         pack->head->codebook_offs = pack->offs;
@@ -406,6 +709,7 @@ err:
     if (pack)
         buf = pack->buffer;
     free(order);
+    free(rank);
     free(pack);
     if (err){
         free(buf);
@@ -432,7 +736,7 @@ struct ddb_cons *ddb_cons_new()
     return db;
 }
 
-struct ddb_cons *ddb_cons_ddb(struct ddb *db)
+struct ddb_cons *ddb_cons_ddb(const struct ddb *db)
 {
   struct ddb_cons *cons;
   struct ddb_cursor *keys = NULL, *vals = NULL;
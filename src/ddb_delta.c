@@ -63,6 +63,45 @@ void ddb_delta_cursor_next(struct ddb_delta_cursor *c)
     }
 }
 
+/* returns the next delta without moving the cursor */
+uint32_t ddb_delta_cursor_peek(const struct ddb_delta_cursor *c)
+{
+    return c->num_left ? read_bits(c->deltas, c->offset, c->bits): 0;
+}
+
+uint32_t ddb_delta_num_skips(uint32_t num_items)
+{
+    return num_items ? (num_items - 1) / SKIP_INTERVAL: 0;
+}
+
+/* Moves the cursor to the last sampled entry below id, if it is ahead
+   of the cursor. skips[j] is the ID of entry (j + 1) * SKIP_INTERVAL,
+   counting from one. */
+void ddb_delta_cursor_skip(struct ddb_delta_cursor *c,
+                           const valueid_t *skips,
+                           uint32_t num_items,
+                           valueid_t id)
+{
+    uint32_t lo = (num_items - c->num_left) / SKIP_INTERVAL;
+    uint32_t hi = ddb_delta_num_skips(num_items);
+    uint64_t steps;
+
+    /* the common case: id is before the next sample */
+    if (lo >= hi || skips[lo] >= id)
+        return;
+    while (lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (skips[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    steps = (uint64_t)lo * SKIP_INTERVAL;
+    c->cur_id = skips[lo - 1];
+    c->offset = 5 + steps * c->bits;
+    c->num_left = num_items - steps;
+}
+
 void ddb_delta_cursor(struct ddb_delta_cursor *c, const char *src)
 {
     c->num_left = *(uint32_t*)src;
@@ -6,6 +6,11 @@
 
 #include <ddb_types.h>
 
+/* Posting lists longer than this have the ID of every SKIP_INTERVAL'th
+   entry sampled in the skips section, so that a cursor can be moved
+   near an ID without decoding everything before it. */
+#define SKIP_INTERVAL 128
+
 struct ddb_delta_cursor{
     const char *deltas;
     uint32_t bits;
@@ -15,6 +20,12 @@ struct ddb_delta_cursor{
 };
 
 void ddb_delta_cursor_next(struct ddb_delta_cursor *c);
+uint32_t ddb_delta_cursor_peek(const struct ddb_delta_cursor *c);
+void ddb_delta_cursor_skip(struct ddb_delta_cursor *c,
+                           const valueid_t *skips,
+                           uint32_t num_items,
+                           valueid_t id);
+uint32_t ddb_delta_num_skips(uint32_t num_items);
 
 void ddb_delta_cursor(struct ddb_delta_cursor *c, const char *src);
 
@@ -0,0 +1,694 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <discodb.h>
+#include <ddb_internal.h>
+#include <ddb_bitmap.h>
+#include <ddb_hash.h>
+
+/*
+ * Expressions are trees of AND, OR and NOT nodes over query terms,
+ * evaluated without normalizing them to CNF first. They are compiled to
+ * a list of distinct nodes, where each node comes after its arguments.
+ * Subexpressions that occur many times in the tree, as the same pointer
+ * or as equal copies, become a single node. A term is opened once
+ * however many times it occurs.
+ *
+ * The nodes are evaluated on windows of value IDs, each node to a bitmap
+ * of the window computed from the bitmaps of its arguments. A window
+ * starts at the first ID that the root may match, as told by the lower
+ * bounds of the nodes: the current ID of a term, the minimum of the
+ * arguments of an OR and the maximum of those of an AND. NOT nodes may
+ * match anywhere.
+ */
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* narrower windows are used for large expressions to keep the bitmaps
+   of all the nodes within this many bytes */
+#define MAX_BITMAPS_SIZE (16 * 1024 * 1024)
+
+struct expr_builder{
+    struct ddb_expr_cursor *x;
+    uint32_t num_alloc;
+    uint32_t args_alloc;
+    /* the term of each node, NULL for the view */
+    const struct ddb_query_term **terms;
+    uint32_t *hashes;
+    /* hash tables of the nodes by structure and of the expressions
+       compiled so far by address */
+    uint32_t *nodes;
+    const struct ddb_expr **exprs;
+    uint32_t *expr_nodes;
+    uint32_t num_exprs;
+    uint32_t table_size;
+    int err;
+};
+
+static inline void set_bit(uint64_t *b, uint32_t offset)
+{
+    b[offset >> 6] |= 1ULL << (offset & 63);
+}
+
+static int is_literal(const struct ddb_expr *e)
+{
+    return e->op == DDB_EXPR_TERM ||
+           (e->op == DDB_EXPR_NOT && e->num_args == 1 &&
+            e->args[0]->op == DDB_EXPR_TERM);
+}
+
+static int is_clause(const struct ddb_expr *e)
+{
+    uint32_t i;
+    if (is_literal(e))
+        return 1;
+    if (e->op != DDB_EXPR_OR || !e->num_args)
+        return 0;
+    for (i = 0; i < e->num_args; i++)
+        if (!is_literal(e->args[i]))
+            return 0;
+    return 1;
+}
+
+static uint32_t num_literals(const struct ddb_expr *e)
+{
+    return is_literal(e) ? 1: e->num_args;
+}
+
+static void add_literals(const struct ddb_expr *e,
+                         struct ddb_query_clause *clause,
+                         struct ddb_query_term *terms)
+{
+    uint32_t i, n = num_literals(e);
+    clause->terms = terms;
+    clause->num_terms = n;
+    for (i = 0; i < n; i++){
+        const struct ddb_expr *l = is_literal(e) ? e: e->args[i];
+        if (l->op == DDB_EXPR_NOT){
+            terms[i] = l->args[0]->term;
+            terms[i].nnot = !terms[i].nnot;
+        }else
+            terms[i] = l->term;
+    }
+}
+
+/* Returns 1 and the expression as clauses, in a single allocation, if
+   it is in CNF. Returns 0 if it is not and -1 if out of memory. */
+int ddb_expr_clauses(const struct ddb_expr *expr,
+                     struct ddb_query_clause **clauses,
+                     uint32_t *num_clauses)
+{
+    const struct ddb_expr *const *args = &expr;
+    struct ddb_query_term *terms;
+    uint32_t i, num_terms = 0, n = 1;
+
+    if (!is_clause(expr)){
+        if (expr->op != DDB_EXPR_AND || !expr->num_args)
+            return 0;
+        args = expr->args;
+        n = expr->num_args;
+        for (i = 0; i < n; i++)
+            if (!is_clause(args[i]))
+                return 0;
+    }
+    for (i = 0; i < n; i++)
+        num_terms += num_literals(args[i]);
+    if (!(*clauses = malloc(n * sizeof(struct ddb_query_clause) +
+                            num_terms * sizeof(struct ddb_query_term))))
+        return -1;
+    terms = (struct ddb_query_term*)&(*clauses)[n];
+    for (i = 0; i < n; i++){
+        add_literals(args[i], &(*clauses)[i], terms);
+        terms += (*clauses)[i].num_terms;
+    }
+    *num_clauses = n;
+    return 1;
+}
+
+static uint32_t node_hash(int op,
+                          const uint32_t *args,
+                          uint32_t num_args,
+                          const struct ddb_query_term *t)
+{
+    if (op != DDB_EXPR_TERM)
+        return SuperFastHash((const char*)args,
+                             num_args * sizeof(uint32_t)) ^ op;
+    if (!t)
+        return 0;
+    return SuperFastHash(t->key.data, t->key.length) ^ t->type;
+}
+
+static int node_equals(const struct expr_builder *b,
+                       uint32_t i,
+                       int op,
+                       const uint32_t *args,
+                       uint32_t num_args,
+                       const struct ddb_query_term *t)
+{
+    const struct ddb_expr_node *node = &b->x->nodes[i];
+    const struct ddb_query_term *u = b->terms[i];
+
+    if (node->op != op)
+        return 0;
+    if (op != DDB_EXPR_TERM)
+        return node->num_args == num_args &&
+               !memcmp(&b->x->args[node->args], args,
+                       num_args * sizeof(uint32_t));
+    if (!t || !u)
+        return t == u;
+    /* meta terms are equal if they share their sub-query */
+    return t->type == u->type &&
+           t->key.length == u->key.length &&
+           !memcmp(t->key.data, u->key.data, t->key.length) &&
+           t->clauses == u->clauses &&
+           t->num_clauses == u->num_clauses;
+}
+
+
+/* returns the slot of a node equal to the given one, or the empty slot
+   where it belongs */
+static uint32_t *find_node(const struct expr_builder *b,
+                           uint32_t hash,
+                           int op,
+                           const uint32_t *args,
+                           uint32_t num_args,
+                           const struct ddb_query_term *t)
+{
+    uint32_t mask = b->table_size - 1, i = hash & mask;
+    while (b->nodes[i]){
+        uint32_t j = b->nodes[i] - 1;
+        if (b->hashes[j] == hash &&
+                node_equals(b, j, op, args, num_args, t))
+            break;
+        i = (i + 1) & mask;
+    }
+    return &b->nodes[i];
+}
+
+static uint32_t find_expr(const struct expr_builder *b,
+                          const struct ddb_expr *e)
+{
+    uint32_t mask = b->table_size - 1;
+    uint32_t i = SuperFastHash((const char*)&e, sizeof(e)) & mask;
+    while (b->exprs[i] && b->exprs[i] != e)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Both tables are kept at most half full. */
+static int grow_tables(struct expr_builder *b)
+{
+    const struct ddb_expr **exprs = b->exprs;
+    uint32_t *expr_nodes = b->expr_nodes;
+    uint32_t i, j, old_size = b->table_size;
+
+    if (2 * MAX(b->x->num_nodes, b->num_exprs) < old_size)
+        return 0;
+    b->table_size = old_size ? old_size * 2: 64;
+    free(b->nodes);
+    b->nodes = calloc(b->table_size, sizeof(uint32_t));
+    b->exprs = calloc(b->table_size, sizeof(struct ddb_expr*));
+    b->expr_nodes = calloc(b->table_size, sizeof(uint32_t));
+    if (!b->nodes || !b->exprs || !b->expr_nodes){
+        free(exprs);
+        free(expr_nodes);
+        return -1;
+    }
+    for (i = 0; i < b->x->num_nodes; i++){
+        j = b->hashes[i] & (b->table_size - 1);
+        while (b->nodes[j])
+            j = (j + 1) & (b->table_size - 1);
+        b->nodes[j] = i + 1;
+    }
+    for (i = 0; i < old_size; i++)
+        if (exprs[i]){
+            j = find_expr(b, exprs[i]);
+            b->exprs[j] = exprs[i];
+            b->expr_nodes[j] = expr_nodes[i];
+        }
+    free(exprs);
+    free(expr_nodes);
+    return 0;
+}
+
+static int add_node(struct expr_builder *b,
+                    int op,
+                    const uint32_t *args,
+                    uint32_t num_args,
+                    const struct ddb_query_term *t,
+                    uint32_t *index)
+{
+    struct ddb_expr_cursor *x = b->x;
+    struct ddb_expr_node *node;
+    uint32_t hash = node_hash(op, args, num_args, t), *slot;
+
+    if (grow_tables(b))
+        return -1;
+    if (*(slot = find_node(b, hash, op, args, num_args, t))){
+        *index = *slot - 1;
+        return 0;
+    }
+    if (x->num_nodes == b->num_alloc){
+        uint32_t n = b->num_alloc ? b->num_alloc * 2: 16;
+        void *p;
+        if (!(p = realloc(x->nodes, n * sizeof(struct ddb_expr_node))))
+            return -1;
+        x->nodes = p;
+        if (!(p = realloc(b->terms, n * sizeof(struct ddb_query_term*))))
+            return -1;
+        b->terms = p;
+        if (!(p = realloc(b->hashes, n * sizeof(uint32_t))))
+            return -1;
+        b->hashes = p;
+        b->num_alloc = n;
+    }
+    if (x->num_args + num_args > b->args_alloc){
+        uint32_t n = MAX(b->args_alloc * 2, x->num_args + num_args);
+        uint32_t *p;
+        if (!(p = realloc(x->args, n * sizeof(uint32_t))))
+            return -1;
+        x->args = p;
+        b->args_alloc = n;
+    }
+    node = &x->nodes[x->num_nodes];
+    memset(node, 0, sizeof(struct ddb_expr_node));
+    node->op = op;
+    node->args = x->num_args;
+    node->num_args = num_args;
+    if (num_args)
+        memcpy(&x->args[x->num_args], args, num_args * sizeof(uint32_t));
+    x->num_args += num_args;
+    b->terms[x->num_nodes] = t;
+    b->hashes[x->num_nodes] = hash;
+    *slot = x->num_nodes + 1;
+    *index = x->num_nodes++;
+    return 0;
+}
+
+static int index_cmp(const void *p1, const void *p2)
+{
+    const uint32_t x = *(const uint32_t*)p1;
+    const uint32_t y = *(const uint32_t*)p2;
+    return x < y ? -1: x > y;
+}
+
+/* Arguments of AND and OR nodes are sorted and made unique, so that
+   the order and repetitions of arguments don't make nodes differ. */
+static int compile(struct expr_builder *b,
+                   const struct ddb_expr *e,
+                   uint32_t *index)
+{
+    struct ddb_expr_cursor *x = b->x;
+    uint32_t i, j, n = 0, *args;
+
+    if (grow_tables(b))
+        return -1;
+    if (b->exprs[j = find_expr(b, e)]){
+        *index = b->expr_nodes[j];
+        return 0;
+    }
+    switch (e->op){
+        case DDB_EXPR_TERM:
+            if (add_node(b, DDB_EXPR_TERM, NULL, 0, &e->term, &i))
+                return -1;
+            if (e->term.nnot && add_node(b, DDB_EXPR_NOT, &i, 1, NULL, &i))
+                return -1;
+            break;
+        case DDB_EXPR_NOT:
+            if (e->num_args != 1)
+                goto unsupported;
+            if (compile(b, e->args[0], &j))
+                return -1;
+            if (x->nodes[j].op == DDB_EXPR_NOT)
+                i = x->args[x->nodes[j].args];
+            else if (add_node(b, DDB_EXPR_NOT, &j, 1, NULL, &i))
+                return -1;
+            break;
+        case DDB_EXPR_AND:
+        case DDB_EXPR_OR:
+            if (!(args = malloc((e->num_args + 1) * sizeof(uint32_t))))
+                return -1;
+            for (j = 0; j < e->num_args; j++)
+                if (compile(b, e->args[j], &args[j])){
+                    free(args);
+                    return -1;
+                }
+            qsort(args, e->num_args, sizeof(uint32_t), index_cmp);
+            for (j = 0; j < e->num_args; j++)
+                if (!n || args[j] != args[n - 1])
+                    args[n++] = args[j];
+            if (n == 1)
+                i = args[0];
+            else if (add_node(b, e->op, args, n, NULL, &i)){
+                free(args);
+                return -1;
+            }
+            free(args);
+            break;
+        default:
+            goto unsupported;
+    }
+    /* the arguments may have grown the tables */
+    if (grow_tables(b))
+        return -1;
+    j = find_expr(b, e);
+    b->exprs[j] = e;
+    b->expr_nodes[j] = *index = i;
+    ++b->num_exprs;
+    return 0;
+unsupported:
+    b->err = DDB_ERR_QUERY_NOT_SUPPORTED;
+    return -1;
+}
+
+/* Drops the nodes that the root doesn't depend on, left behind by
+   double negations, and makes the root the last node. */
+static int prune(struct expr_builder *b, uint32_t root)
+{
+    struct ddb_expr_cursor *x = b->x;
+    uint32_t i, j, k, n = 0, num_args = 0, *map;
+
+    if (!(map = calloc(root + 1, sizeof(uint32_t))))
+        return -1;
+    map[root] = 1;
+    for (i = root + 1; i--;)
+        if (map[i])
+            for (j = 0; j < x->nodes[i].num_args; j++)
+                map[x->args[x->nodes[i].args + j]] = 1;
+    for (i = 0; i <= root; i++){
+        struct ddb_expr_node *node = &x->nodes[i];
+        if (!map[i])
+            continue;
+        /* arguments move only backwards, as nodes do */
+        for (k = 0; k < node->num_args; k++)
+            x->args[num_args + k] = map[x->args[node->args + k]] - 1;
+        node->args = num_args;
+        num_args += node->num_args;
+        x->nodes[n] = *node;
+        b->terms[n] = b->terms[i];
+        map[i] = ++n;
+    }
+    x->num_nodes = n;
+    x->num_args = num_args;
+    free(map);
+    return 0;
+}
+
+/* Opens the terms and the view, and estimates the size of each node
+   from the lengths of the posting lists. */
+static int open_nodes(struct ddb_cursor *c,
+                      const struct expr_builder *b,
+                      const struct ddb_view *view,
+                      uint32_t num_values)
+{
+    struct ddb_expr_cursor *x = &c->cursor.expr;
+    uint32_t i, j;
+
+    for (i = 0; i < x->num_nodes; i++){
+        struct ddb_expr_node *node = &x->nodes[i];
+        const uint32_t *args = &x->args[node->args];
+        switch (node->op){
+            case DDB_EXPR_TERM:
+                if (b->terms[i]){
+                    /* negations are nodes of their own */
+                    struct ddb_query_term t = *b->terms[i];
+                    t.nnot = 0;
+                    if (ddb_cnf_term_open(c->db, &node->term, &t,
+                                          c->key_results))
+                        return -1;
+                    node->estimate = node->term.cursor->num_items;
+                }else{
+                    if (!(node->term.cursor =
+                            calloc(1, sizeof(struct ddb_cursor)))){
+                        ddb_set_error(c->db, DDB_ERR_OUT_OF_MEMORY);
+                        return -1;
+                    }
+                    node->term.cursor->cursor.view.view = view;
+                    node->term.next = ddb_view_next;
+                    node->estimate = view->num_values;
+                }
+                break;
+            case DDB_EXPR_AND:
+                node->estimate = num_values;
+                for (j = 0; j < node->num_args; j++)
+                    node->estimate = MIN(node->estimate,
+                                         x->nodes[args[j]].estimate);
+                break;
+            case DDB_EXPR_OR:
+                for (j = 0; j < node->num_args; j++)
+                    node->estimate += x->nodes[args[j]].estimate;
+                break;
+            case DDB_EXPR_NOT:
+                node->estimate = num_values;
+        }
+        node->estimate = MIN(node->estimate, num_values);
+    }
+    return 0;
+}
+
+/* Queries on values return the keys that satisfy them, as with
+   ddb_query(). Terms on keys and values can't be mixed. */
+static int key_results(const struct ddb_cursor *c,
+                       const struct expr_builder *b,
+                       const struct ddb_view *view)
+{
+    uint32_t i, num_terms = 0, num_values = 0;
+    for (i = 0; i < c->cursor.expr.num_nodes; i++)
+        if (b->terms[i]){
+            ++num_terms;
+            if (b->terms[i]->type == DDB_TERM_VALUE)
+                ++num_values;
+        }
+    if (!num_values)
+        return 0;
+    if (num_values < num_terms || view || !c->db->inverted)
+        return -1;
+    return 1;
+}
+
+int ddb_expr_cursor_init(struct ddb_cursor *c,
+                         const struct ddb_expr *expr,
+                         const struct ddb_view *view)
+{
+    struct ddb_expr_cursor *x = &c->cursor.expr;
+    struct expr_builder b;
+    uint32_t i, root, num_values;
+    int ret = -1;
+
+    memset(&b, 0, sizeof(b));
+    b.x = x;
+    b.err = DDB_ERR_OUT_OF_MEMORY;
+    if (compile(&b, expr, &root))
+        goto err;
+    if (view){
+        uint32_t args[2] = {root};
+        if (add_node(&b, DDB_EXPR_TERM, NULL, 0, NULL, &args[1]) ||
+                add_node(&b, DDB_EXPR_AND, args, 2, NULL, &root))
+            goto err;
+    }
+    if (prune(&b, root))
+        goto err;
+    if ((c->key_results = key_results(c, &b, view)) == -1){
+        b.err = DDB_ERR_QUERY_NOT_SUPPORTED;
+        goto err;
+    }
+    num_values = c->key_results ? c->db->num_keys: c->db->num_uniq_values;
+    /* the error is set by the term */
+    b.err = 0;
+    if (open_nodes(c, &b, view, num_values))
+        goto err;
+
+    b.err = DDB_ERR_OUT_OF_MEMORY;
+    ddb_bitmap_init();
+    x->window_size = ddb_window_size(x->nodes[x->num_nodes - 1].estimate,
+                                     num_values);
+    while (x->window_size > MIN_WINDOW_SIZE &&
+           x->num_nodes * (uint64_t)(x->window_size >> 3) > MAX_BITMAPS_SIZE)
+        x->window_size >>= 1;
+    if (!(x->bitmaps = calloc(x->num_nodes,
+                              (x->window_size >> 6) * sizeof(uint64_t))))
+        goto err;
+    for (i = 0; i < x->num_nodes; i++){
+        struct ddb_expr_node *node = &x->nodes[i];
+        node->bitmap = &x->bitmaps[i * (x->window_size >> 6)];
+        if (node->op == DDB_EXPR_TERM)
+            node->term.next(&node->term);
+    }
+    x->base_id = 1;
+    x->offset = x->end = 0;
+    x->end_id = num_values + 1LLU;
+    x->limit = UINT64_MAX;
+    ret = 0;
+err:
+    if (ret && b.err)
+        ddb_set_error(c->db, b.err);
+    free(b.terms);
+    free(b.hashes);
+    free(b.nodes);
+    free(b.exprs);
+    free(b.expr_nodes);
+    return ret;
+}
+
+/* Evaluates the nodes on the next window that the root may match in.
+   Returns 0 if there is none. */
+static int next_window(struct ddb_expr_cursor *x)
+{
+    struct ddb_expr_node *root = &x->nodes[x->num_nodes - 1];
+    valueid_t pos = x->base_id + x->end, base, maxid;
+    uint32_t i, j, num_words;
+
+    for (i = 0; i < x->num_nodes; i++){
+        struct ddb_expr_node *node = &x->nodes[i];
+        const uint32_t *args = &x->args[node->args];
+        switch (node->op){
+            case DDB_EXPR_TERM:
+                node->lower = node->term.empty ? x->end_id:
+                              MAX(node->term.cur_id, pos);
+                break;
+            case DDB_EXPR_AND:
+                node->lower = pos;
+                for (j = 0; j < node->num_args; j++)
+                    node->lower = MAX(node->lower, x->nodes[args[j]].lower);
+                break;
+            case DDB_EXPR_OR:
+                node->lower = x->end_id;
+                for (j = 0; j < node->num_args; j++)
+                    node->lower = MIN(node->lower, x->nodes[args[j]].lower);
+                break;
+            case DDB_EXPR_NOT:
+                node->lower = pos;
+        }
+    }
+    if ((base = root->lower) >= x->end_id)
+        return 0;
+    maxid = MIN(base + x->window_size, x->end_id);
+    num_words = (maxid - base + 63) >> 6;
+
+    for (i = 0; i < x->num_nodes; i++){
+        struct ddb_expr_node *node = &x->nodes[i];
+        const uint32_t *args = &x->args[node->args];
+        uint64_t *b = node->bitmap;
+        switch (node->op){
+            case DDB_EXPR_TERM:
+                memset(b, 0, num_words * sizeof(uint64_t));
+                if (node->lower >= maxid)
+                    break;
+                ddb_term_seek(&node->term, base);
+                while (!node->term.empty && node->term.cur_id < maxid){
+                    set_bit(b, node->term.cur_id - base);
+                    node->term.next(&node->term);
+                }
+                break;
+            case DDB_EXPR_AND:
+            case DDB_EXPR_OR:
+                if (!node->num_args){
+                    memset(b, node->op == DDB_EXPR_AND ? 0xff: 0,
+                           num_words * sizeof(uint64_t));
+                    break;
+                }
+                memcpy(b, x->nodes[args[0]].bitmap,
+                       num_words * sizeof(uint64_t));
+                for (j = 1; j < node->num_args; j++)
+                    if (node->op == DDB_EXPR_AND)
+                        ddb_bitmap.isect(b, x->nodes[args[j]].bitmap,
+                                         num_words);
+                    else
+                        ddb_bitmap.unite(b, x->nodes[args[j]].bitmap,
+                                         num_words);
+                break;
+            case DDB_EXPR_NOT:
+                for (j = 0; j < num_words; j++)
+                    b[j] = ~x->nodes[args[0]].bitmap[j];
+        }
+    }
+    /* complements may have set bits past the end of the window */
+    if ((maxid - base) & 63)
+        root->bitmap[num_words - 1] &= ~0ULL >> (64 - ((maxid - base) & 63));
+    x->base_id = base;
+    x->offset = 0;
+    x->end = maxid - base;
+    return 1;
+}
+
+static valueid_t next_id(struct ddb_expr_cursor *x)
+{
+    while (1){
+        const uint64_t *root = x->nodes[x->num_nodes - 1].bitmap;
+        while (x->offset < x->end){
+            uint64_t w = root[x->offset >> 6] >> (x->offset & 63);
+            if (w){
+                x->offset += __builtin_ctzll(w);
+                return x->base_id + x->offset++;
+            }
+            x->offset = (x->offset | 63) + 1;
+        }
+        if (!next_window(x))
+            return 0;
+    }
+}
+
+/* Offsets are skipped without decoding any values. */
+const struct ddb_entry *ddb_expr_cursor_next(struct ddb_cursor *c)
+{
+    struct ddb_expr_cursor *x = &c->cursor.expr;
+    valueid_t id;
+
+    if (!x->limit)
+        return NULL;
+    for (; x->skip; x->skip--)
+        if (!next_id(x))
+            return NULL;
+    if (!(id = next_id(x)))
+        return NULL;
+    --x->limit;
+    if (ddb_get_valuestr(c, id))
+        return NULL;
+    return &c->entry;
+}
+
+uint64_t ddb_expr_cursor_count(struct ddb_cursor *c)
+{
+    struct ddb_expr_cursor *x = &c->cursor.expr;
+    uint64_t n = 0;
+
+    for (; x->skip; x->skip--)
+        if (!next_id(x))
+            return 0;
+    while (n < x->limit){
+        const uint64_t *root = x->nodes[x->num_nodes - 1].bitmap;
+        if (x->offset < x->end){
+            uint32_t first = (x->offset >> 6) + 1;
+            n += __builtin_popcountll(root[x->offset >> 6] >>
+                                      (x->offset & 63));
+            if (first < (x->end + 63) >> 6)
+                n += ddb_bitmap.count(&root[first],
+                                      ((x->end + 63) >> 6) - first);
+            x->offset = x->end;
+        }
+        if (!next_window(x))
+            break;
+    }
+    n = MIN(n, x->limit);
+    x->limit -= n;
+    return n;
+}
+
+void ddb_expr_cursor_free(struct ddb_cursor *c)
+{
+    struct ddb_expr_cursor *x = &c->cursor.expr;
+    uint32_t i;
+
+    for (i = 0; i < x->num_nodes; i++){
+        struct ddb_cnf_term *t = &x->nodes[i].term;
+        if (x->nodes[i].op != DDB_EXPR_TERM)
+            continue;
+        if (t->next == ddb_union_next)
+            ddb_union_cursor_free(t->cursor);
+        free(t->cursor);
+    }
+    free(x->nodes);
+    free(x->args);
+    free(x->bitmaps);
+}
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <discodb.h>
+#include <ddb_internal.h>
+
+/*
+ * Facet counts are the sizes of the intersections of a query result
+ * with the posting lists of many keys. The result is read only once, a
+ * window of value IDs at a time, into a bitmap, and the posting list of
+ * every facet is read over the window with each of its IDs tested
+ * against the bitmap. The lists are delta coded, so testing their IDs
+ * one by one costs the same as decoding them into bitmaps of their own
+ * to AND and popcount, without the bitmaps to clear.
+ *
+ * A window starts at the next ID of the result, so that the facets skip
+ * over the ranges where the result has nothing, through the skip lists
+ * if the db has them. A facet that has many more IDs than the result in
+ * a window is probed at the IDs of the result instead of being read.
+ */
+
+/* how many more IDs a facet needs to have than the result in a window
+   to be probed */
+#define PROBE_RATIO 8
+
+static inline void set_bit(uint64_t *b, uint32_t offset)
+{
+    b[offset >> 6] |= 1ULL << (offset & 63);
+}
+
+static inline uint64_t get_bit(const uint64_t *b, uint32_t offset)
+{
+    return (b[offset >> 6] >> (offset & 63)) & 1;
+}
+
+static uint64_t window_count(const struct ddb *db,
+                             struct ddb_cnf_term *t,
+                             const uint64_t *bitmap,
+                             const valueid_t *ids,
+                             uint32_t num_ids)
+{
+    valueid_t base = ids[0], last = ids[num_ids - 1];
+    uint64_t n = 0, expected;
+    uint32_t i;
+
+    expected = t->cursor->num_items * (uint64_t)(last - base + 1) /
+               (db->num_uniq_values + 1);
+    if (db->skips && expected > (uint64_t)num_ids * PROBE_RATIO){
+        for (i = 0; i < num_ids && !t->empty; i++){
+            ddb_term_seek(t, ids[i]);
+            n += t->cur_id == ids[i];
+        }
+        return n;
+    }
+    ddb_term_seek(t, base);
+    while (!t->empty && t->cur_id <= last){
+        n += get_bit(bitmap, t->cur_id - base);
+        t->next(t);
+    }
+    return n;
+}
+
+/* Orders facets by their counts, ties by their positions. */
+static inline int facet_before(const uint64_t *counts, uint32_t a, uint32_t b)
+{
+    return counts[a] > counts[b] || (counts[a] == counts[b] && a < b);
+}
+
+/* The root of the heap is the facet that comes last. */
+static void sift_down(uint32_t *heap,
+                      uint32_t size,
+                      uint32_t i,
+                      const uint64_t *counts)
+{
+    while (1){
+        uint32_t m = i, l = 2 * i + 1, r = l + 1, tmp;
+        if (l < size && facet_before(counts, heap[m], heap[l]))
+            m = l;
+        if (r < size && facet_before(counts, heap[m], heap[r]))
+            m = r;
+        if (m == i)
+            return;
+        tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+/* Puts the positions of the k facets with the largest counts to top, in
+   order, with a heap of the best ones found so far. */
+static uint32_t top_facets(const uint64_t *counts,
+                           uint32_t num_facets,
+                           uint32_t *top,
+                           uint32_t k)
+{
+    uint32_t i, n;
+
+    k = k < num_facets ? k: num_facets;
+    for (i = 0; i < k; i++)
+        top[i] = i;
+    for (i = k / 2; i--;)
+        sift_down(top, k, i, counts);
+    for (i = k; i < num_facets; i++)
+        if (k && facet_before(counts, i, top[0])){
+            top[0] = i;
+            sift_down(top, k, 0, counts);
+        }
+    for (n = k; n > 1;){
+        uint32_t tmp = top[0];
+        top[0] = top[--n];
+        top[n] = tmp;
+        sift_down(top, n, 0, counts);
+    }
+    return k;
+}
+
+int ddb_facet_counts(struct ddb_cursor *query,
+                     const struct ddb_entry *facets,
+                     uint32_t num_facets,
+                     uint64_t *counts,
+                     uint32_t *top,
+                     uint32_t k)
+{
+    const struct ddb *db = query->db;
+    struct ddb_cnf_term *terms = NULL;
+    uint64_t *bitmap = NULL;
+    valueid_t *ids = NULL, id;
+    uint32_t i, num_ids;
+    int err = 0;
+
+    /* key IDs can't be intersected with posting lists */
+    if (query->key_results){
+        ddb_set_error(db, DDB_ERR_QUERY_NOT_SUPPORTED);
+        return -1;
+    }
+    if (!(terms = calloc(num_facets + 1, sizeof(struct ddb_cnf_term))))
+        goto oom;
+    if (!(bitmap = calloc(MAX_WINDOW_SIZE / 64, sizeof(uint64_t))))
+        goto oom;
+    if (!(ids = malloc(MAX_WINDOW_SIZE * sizeof(valueid_t))))
+        goto oom;
+    for (i = 0; i < num_facets; i++){
+        struct ddb_query_term term;
+        memset(&term, 0, sizeof(term));
+        term.key = facets[i];
+        /* the error is set by the term */
+        if (ddb_cnf_term_open(db, &terms[i], &term, 0))
+            goto fail;
+        terms[i].next(&terms[i]);
+        counts[i] = 0;
+    }
+
+    id = ddb_next_id(query, &err);
+    while (id){
+        valueid_t base = id;
+        num_ids = 0;
+        do{
+            /* multisets may repeat IDs */
+            if (num_ids && id == ids[num_ids - 1])
+                continue;
+            set_bit(bitmap, id - base);
+            ids[num_ids++] = id;
+        }while ((id = ddb_next_id(query, &err)) && id - base < MAX_WINDOW_SIZE);
+
+        for (i = 0; i < num_facets; i++)
+            counts[i] += window_count(db, &terms[i], bitmap, ids, num_ids);
+        for (i = 0; i < num_ids; i++)
+            bitmap[(ids[i] - base) >> 6] = 0;
+    }
+    if (err){
+        ddb_set_error(db, err);
+        goto fail;
+    }
+    if (top)
+        k = top_facets(counts, num_facets, top, k);
+    for (i = 0; i < num_facets; i++)
+        free(terms[i].cursor);
+    free(terms);
+    free(bitmap);
+    free(ids);
+    return top ? k: 0;
+oom:
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+fail:
+    if (terms)
+        for (i = 0; i < num_facets; i++)
+            free(terms[i].cursor);
+    free(terms);
+    free(bitmap);
+    free(ids);
+    return -1;
+}
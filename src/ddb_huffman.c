@@ -340,11 +340,13 @@ int ddb_decompress(
     const char *src,
     uint32_t src_len,
     uint32_t *size,
-    char **buf,
-    uint64_t *buf_len)
+    char *buf,
+    uint64_t buf_len)
 {
-    char *p = *buf;
-    uint32_t k = 0;
+    /* Decodes at most buf_len bytes to buf. The full decoded length is
+     * always returned in size, so that the caller can size the buffer
+     * exactly and try again if the value didn't fit. */
+    uint64_t k = 0;
     uint64_t num_bits = src_len * 8LLU - read_bits(src, 0, 3);
     uint64_t offs = 3;
 #if 0
@@ -364,32 +366,27 @@ int ddb_decompress(
 
     while (offs < num_bits){
         uint32_t val = read_bits(src, offs, 17);
-        if (k + 4 > *buf_len){
-            *buf_len += 1024 * 1024;
-            if (!(*buf = p = realloc(*buf, *buf_len)))
-                return -1;
-        }
         if (val & 1){
             val >>= 1;
-            memcpy(p + k, &book[val].symbol, 4);
+            if (k + 4 <= buf_len)
+                memcpy(buf + k, &book[val].symbol, 4);
             #ifdef HUFFMAN_DEBUG
-            fprintf(stderr, "%u (%lu) VALUE[%u] (b %u): ", k, offs, val, book[val].bits);
+            fprintf(stderr, "%lu (%lu) VALUE[%u] (b %u): ", k, offs, val, book[val].bits);
             print_symbol(book[val].symbol);
             fprintf(stderr, "\n");
             #endif
             offs += book[val].bits + 1;
             k += 4;
         }else{
-            p[k] = (val >> 1) & 255;
+            if (k < buf_len)
+                buf[k] = (val >> 1) & 255;
             #ifdef HUFFMAN_DEBUG
-            fprintf(stderr, "%u (%lu) LITERAL: %c\n", k, offs, (val >> 1) & 255);
+            fprintf(stderr, "%lu (%lu) LITERAL: %c\n", k, offs, (val >> 1) & 255);
             #endif
             offs += 9;
             ++k;
         }
     }
     *size = k;
-    return 0;
+    return k > buf_len ? -1: 0;
 }
-
-
@@ -32,7 +32,7 @@ int ddb_decompress(
     const char *src,
     uint32_t src_len,
     uint32_t *size,
-    char **buf,
-    uint64_t *buf_len);
+    char *buf,
+    uint64_t buf_len);
 
 #endif /* __DDB_HUFFMAN__ */
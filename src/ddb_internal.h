@@ -2,12 +2,17 @@
 #ifndef __DDB_INTERNAL_H__
 #define __DDB_INTERNAL_H__
 
+#include <pthread.h>
+
 #include <discodb.h>
 #include <ddb_types.h>
 #include <ddb_huffman.h>
 #include <ddb_delta.h>
 
 #define DISCODB_MAGIC 0x4D85BE61D14DE5BULL
+/* Sorted keys with a hash change what the hash slots hold, so readers
+   that don't know F_SORTED must not take such a db for their own. */
+#define DISCODB_MAGIC_SORTED 0x4D85BE61D14DE5CULL
 
 #define COMPRESS_MIN_TOTAL_SIZE (5 * 1024 * 1024)
 #define COMPRESS_MIN_AVG_VALUE_SIZE 6
@@ -15,10 +20,27 @@
 #define F_HASH 1
 #define F_MULTISET 2
 #define F_COMPRESSED 4
+#define F_MAXVALUE 8
+#define F_SKIPS 16
+#define F_VALUE_INDEX 32
+#define F_INVERTED 64
+#define F_SORTED 128
 
 #define HASFLAG(db, f) (db->flags & f)
 #define SETFLAG(db, f) (db->flags |= f)
 
+#define PREFETCH(addr) __builtin_prefetch(addr)
+
+/* Terms of prepared queries name the IDs of their keys instead of the
+   keys: key.data holds the IDs and key.length their size in bytes. The
+   ID of a missing key is num_keys. */
+#define DDB_TERM_KEY_ID 16
+#define DDB_TERM_META_IDS 17
+
+/* sorted keys are searched through a copy of every
+   KEY_SAMPLE_INTERVAL'th key */
+#define KEY_SAMPLE_INTERVAL 64
+
 struct ddb_header{
     uint64_t magic;
     uint64_t size;
@@ -32,23 +54,42 @@ struct ddb_header{
     uint64_t id2value_offs;
     uint64_t hash_offs;
     uint64_t codebook_offs;
+
+    /* Fields below were appended to the original header. Older
+       files don't have them, so each one is valid only if the
+       corresponding flag is set. */
+    uint64_t max_value_size; /* F_MAXVALUE */
+    uint64_t skips_offs; /* F_SKIPS */
+    uint64_t value_index_offs; /* F_VALUE_INDEX */
+    uint64_t inverted_offs; /* F_INVERTED */
+    uint64_t rank_offs; /* F_SORTED and F_HASH */
+    uint64_t key_samples_offs; /* F_SORTED */
 } __attribute__((packed));
 
 struct ddb{
     uint64_t size;
     uint64_t mmap_size;
 
-    int errno;
     uint32_t num_keys;
     uint32_t num_uniq_values;
     uint32_t flags;
+    uint32_t load_flags;
     uint64_t num_values;
+    uint64_t max_value_size;
 
     const uint64_t *key2values;
     const uint64_t *id2value;
     const uint64_t *hash;
+    const uint64_t *skips;
+    const char *value_hash;
+    const valueid_t *value_index;
+    const uint64_t *inverted;
+    const keyid_t *rank;
+    const uint64_t *key_samples;
 
     const struct ddb_codebook *codebook;
+    struct ddb_cache *cache;
+    uint64_t load_id;
 
     const char *buf;
     void *mmap;
@@ -56,6 +97,7 @@ struct ddb{
 
 struct ddb_key_cursor{
     uint32_t i;
+    uint32_t end;
 };
 
 struct ddb_unique_values_cursor{
@@ -64,37 +106,67 @@ struct ddb_unique_values_cursor{
 
 struct ddb_values_cursor{
     uint32_t i;
+    uint32_t end;
     struct ddb_delta_cursor cur;
 };
 
+/* window sizes in bits, powers of two */
 #ifdef DEBUG
-#define WINDOW_SIZE 64
+#define MIN_WINDOW_SIZE 64
+#define MAX_WINDOW_SIZE 64
 #else
-#define WINDOW_SIZE 1024 /* bits */
+#define MIN_WINDOW_SIZE 1024
+#define MAX_WINDOW_SIZE 65536
 #endif
 
-#define WINDOW_SIZE_BYTES (WINDOW_SIZE >> 3)
-
 struct ddb_view_cons{
     struct ddb_map *map;
 };
 
+#define DDB_VIEW_MAGIC 0x5745495642444444ULL
+
+#define VIEW_ARRAY 0
+#define VIEW_BITMAP 1
+
+/* A view file is the header followed by either the sorted value IDs
+   or a bitmap with a bit for each value ID, whichever is smaller. */
+struct ddb_view_header{
+    uint64_t magic;
+    /* the ID space of the db the view was made for */
+    uint64_t values_size;
+    uint32_t num_uniq_values;
+
+    uint32_t num_values;
+    uint32_t format;
+    uint32_t padding;
+} __attribute__((packed));
+
 struct ddb_view{
     uint32_t num_values;
-    valueid_t values[0];
+    const valueid_t *values; /* VIEW_ARRAY */
+    const uint64_t *bitmap; /* VIEW_BITMAP */
+    uint32_t num_bits;
+    void *mmap;
+    uint64_t mmap_size;
+    valueid_t buf[0];
 };
 
 struct ddb_cnf_term{
     struct ddb_cursor *cursor;
     valueid_t (*next)(struct ddb_cnf_term*);
     valueid_t cur_id;
+    uint32_t count; /* occurrences of cur_id in the posting list */
     int empty;
 };
 
 struct ddb_cnf_clause{
-    char unionn[WINDOW_SIZE_BYTES];
+    uint64_t *unionn;
+    uint32_t lo; /* range of words set in unionn */
+    uint32_t hi;
     struct ddb_cnf_term *terms;
     uint32_t num_terms;
+    uint32_t index; /* position in the query */
+    uint64_t estimate;
 };
 
 struct ddb_cnf_cursor{
@@ -102,10 +174,23 @@ struct ddb_cnf_cursor{
     struct ddb_cnf_term *terms;
     uint32_t num_clauses;
     uint32_t num_terms;
+    int plan;
+    int multiplicity;
+    uint64_t offset; /* results left to skip */
+    uint64_t limit; /* results left to return */
 
-    char *isect;
+    uint64_t *isect;
+    uint64_t *scratch;
     uint32_t isect_offset;
+    uint32_t isect_end;
+    uint32_t lo; /* range of words set in every clause */
+    uint32_t hi;
+    uint32_t *counts;
+    uint32_t counts_lo; /* range of words set in counts */
+    uint32_t counts_hi;
+    uint32_t window_size;
     valueid_t base_id;
+    uint64_t end_id; /* IDs from here on are left out */
 };
 
 struct ddb_view_cursor{
@@ -113,12 +198,97 @@ struct ddb_view_cursor{
     uint32_t index;
 };
 
+/* a posting list of a key matched by a pattern term */
+struct ddb_union_list{
+    struct ddb_delta_cursor cur;
+    const valueid_t *skips;
+    uint32_t num_items;
+};
+
+/* Pattern terms stand for the union of the posting lists of every key
+   they match. Sparse unions are merged through a heap of the lists,
+   ordered by their current IDs. Dense and negated ones are decoded
+   into a bitmap with a bit for each value ID. */
+struct ddb_union_cursor{
+    struct ddb_union_list *lists;
+    uint32_t num_lists;
+    uint64_t *bitmap;
+    uint32_t num_bits;
+    uint32_t index; /* the next ID to look at in bitmap */
+};
+
+/* A node of an expression, see ddb_query_expr(). Arguments are
+   evaluated before the nodes that use them, and each distinct
+   subexpression is a single node. */
+struct ddb_expr_node{
+    int op;
+    uint32_t args; /* offset of the argument indices in expr->args */
+    uint32_t num_args;
+    struct ddb_cnf_term term; /* DDB_EXPR_TERM */
+    uint64_t *bitmap; /* the node in the current window */
+    valueid_t lower; /* no ID below this matches */
+    uint64_t estimate;
+};
+
+struct ddb_expr_cursor{
+    struct ddb_expr_node *nodes;
+    uint32_t num_nodes;
+    uint32_t *args;
+    uint32_t num_args;
+    uint64_t *bitmaps;
+    uint32_t window_size;
+    valueid_t base_id;
+    uint32_t offset; /* the next bit to look at in the root */
+    uint32_t end; /* bits of the root in the current window */
+    uint64_t end_id;
+    uint64_t skip; /* results left to skip */
+    uint64_t limit; /* results left to return */
+};
+
+struct ddb_ids_cursor{
+    valueid_t *ids;
+    uint32_t num_ids;
+    uint32_t i;
+};
+
+struct ddb_range{
+    char *start;
+    uint64_t len;
+};
+
+struct ddb_readahead{
+    pthread_t thread;
+    int running;
+    uint64_t resident_pages;
+    uint64_t fetched_pages;
+    uint32_t num_ranges;
+    struct ddb_range ranges[];
+};
+
+struct ddb_batch_item{
+    valueid_t id;
+    uint64_t offs;
+};
+
+struct ddb_parallel_cursor;
+
 struct ddb_cursor{
     const struct ddb *db;
 
     char *decode_buf;
     uint64_t decode_buf_len;
+    char *into_buf;
+    uint64_t into_buf_len;
     struct ddb_entry entry;
+    valueid_t cur_id;
+
+    struct ddb_batch_item *batch;
+    uint32_t batch_len;
+    char *batch_buf;
+    uint64_t batch_buf_len;
+
+    struct ddb_readahead *readahead;
+    const valueid_t *skips;
 
     union{
         struct ddb_delta_cursor value;
@@ -126,20 +296,69 @@ struct ddb_cursor{
         struct ddb_unique_values_cursor uvalues;
         struct ddb_key_cursor keys;
         struct ddb_cnf_cursor cnf;
+        struct ddb_expr_cursor expr;
         struct ddb_view_cursor view;
+        struct ddb_ids_cursor ids;
+        struct ddb_union_cursor unionn;
+        struct ddb_parallel_cursor *parallel;
     } cursor;
     const struct ddb_entry *(*next)(struct ddb_cursor*);
 
     uint32_t num_items;
+    uint32_t multiplicity;
     int errno;
     int no_valuestr;
+    /* IDs are keys' positions + 1 instead of value IDs */
+    int key_results;
 };
 
+void ddb_set_error(const struct ddb *db, int err);
 int ddb_get_valuestr(struct ddb_cursor *c, valueid_t id);
 const struct ddb_entry *ddb_cnf_cursor_next(struct ddb_cursor *c);
+uint64_t ddb_cnf_cursor_count(struct ddb_cursor *c);
+int ddb_cnf_cursor_init(struct ddb_cursor *c);
+void ddb_cnf_cursor_range(struct ddb_cursor *c, valueid_t start, uint64_t end);
+int ddb_union_cursor_init(struct ddb_cursor *c, int negated);
+void ddb_union_cursor_free(struct ddb_cursor *c);
+int ddb_cnf_term_open(const struct ddb *db,
+                      struct ddb_cnf_term *term,
+                      const struct ddb_query_term *t,
+                      int keys);
+void ddb_term_seek(struct ddb_cnf_term *t, valueid_t id);
+uint32_t ddb_key_id(const struct ddb *db, const struct ddb_entry *key);
+uint32_t ddb_window_size(uint64_t min_count, uint32_t num_values);
+
+int ddb_expr_clauses(const struct ddb_expr *expr,
+                     struct ddb_query_clause **clauses,
+                     uint32_t *num_clauses);
+int ddb_expr_cursor_init(struct ddb_cursor *c,
+                         const struct ddb_expr *expr,
+                         const struct ddb_view *view);
+const struct ddb_entry *ddb_expr_cursor_next(struct ddb_cursor *c);
+uint64_t ddb_expr_cursor_count(struct ddb_cursor *c);
+void ddb_expr_cursor_free(struct ddb_cursor *c);
+
+struct ddb_cursor *ddb_query_range(const struct ddb *db,
+                                   const struct ddb_query_clause *clauses,
+                                   uint32_t num_clauses,
+                                   const struct ddb_view *view,
+                                   valueid_t start,
+                                   uint64_t end,
+                                   int readahead);
+
+uint32_t ddb_parallel_num_chunks(const struct ddb *db, uint32_t num_threads);
+struct ddb_parallel_cursor *ddb_parallel_new(
+        const struct ddb *db,
+        const struct ddb_query_clause *clauses,
+        uint32_t num_clauses,
+        const struct ddb_query_opts *opts);
+void ddb_parallel_free(struct ddb_parallel_cursor *p);
+const struct ddb_entry *ddb_parallel_cursor_next(struct ddb_cursor *c);
 
 valueid_t ddb_val_next(struct ddb_cnf_term *t);
+valueid_t ddb_multi_next(struct ddb_cnf_term *t);
 valueid_t ddb_not_next(struct ddb_cnf_term *t);
 valueid_t ddb_view_next(struct ddb_cnf_term *t);
+valueid_t ddb_union_next(struct ddb_cnf_term *t);
 
 #endif /* __DDB_INTERNAL_H__ */
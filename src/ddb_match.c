@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <discodb.h>
+#include <ddb_internal.h>
+
+/*
+ * Values are ranked by the number of terms that match them, of which
+ * there have to be at least min_match. The posting lists of the terms
+ * are merged WAND style, kept sorted by their current IDs: a value can
+ * only match as many terms as there are lists at it or before it, so
+ * with a threshold of t matches, the lists before the t'th one are
+ * moved straight to its ID, through the skip lists if the db has them.
+ *
+ * The best k values found so far are kept in a heap. Once it is full, a
+ * value has to match more terms than the worst of them to get in, as
+ * the earlier ID wins a tie, which raises the threshold and lets the
+ * merge skip more.
+ */
+
+/* Orders matches by their counts, ties by their IDs. */
+static inline int match_before(const struct ddb_match *a,
+                               const struct ddb_match *b)
+{
+    return a->count > b->count || (a->count == b->count && a->id < b->id);
+}
+
+/* The root of the heap is the match that comes last. */
+static void sift_down(struct ddb_match *heap, uint32_t size, uint32_t i)
+{
+    while (1){
+        uint32_t m = i, l = 2 * i + 1, r = l + 1;
+        struct ddb_match tmp;
+        if (l < size && match_before(&heap[m], &heap[l]))
+            m = l;
+        if (r < size && match_before(&heap[m], &heap[r]))
+            m = r;
+        if (m == i)
+            return;
+        tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+static void sift_up(struct ddb_match *heap, uint32_t i)
+{
+    while (i){
+        uint32_t p = (i - 1) / 2;
+        struct ddb_match tmp;
+        if (!match_before(&heap[p], &heap[i]))
+            return;
+        tmp = heap[i];
+        heap[i] = heap[p];
+        heap[p] = tmp;
+        i = p;
+    }
+}
+
+/* Sorts the live terms by their current IDs and drops the exhausted
+   ones. Only a few terms move at each step, so insertion sort it is. */
+static uint32_t sort_terms(struct ddb_cnf_term **terms, uint32_t num_terms)
+{
+    uint32_t i, j, n = 0;
+    for (i = 0; i < num_terms; i++){
+        struct ddb_cnf_term *t = terms[i];
+        if (t->empty)
+            continue;
+        for (j = n; j && terms[j - 1]->cur_id > t->cur_id; j--)
+            terms[j] = terms[j - 1];
+        terms[j] = t;
+        ++n;
+    }
+    return n;
+}
+
+int ddb_query_min_match(const struct ddb *db,
+                        const struct ddb_query_term *terms,
+                        uint32_t num_terms,
+                        uint32_t min_match,
+                        struct ddb_match *matches,
+                        uint32_t k)
+{
+    struct ddb_cnf_term *buf = NULL, **live = NULL;
+    uint32_t i, n, num_live, num_matches = 0;
+
+    for (i = 0; i < num_terms; i++)
+        if (terms[i].type == DDB_TERM_VALUE){
+            ddb_set_error(db, DDB_ERR_QUERY_NOT_SUPPORTED);
+            return -1;
+        }
+    if (!(buf = calloc(num_terms + 1, sizeof(struct ddb_cnf_term))))
+        goto oom;
+    if (!(live = malloc((num_terms + 1) * sizeof(struct ddb_cnf_term*))))
+        goto oom;
+    for (i = 0; i < num_terms; i++){
+        /* the error is set by the term */
+        if (ddb_cnf_term_open(db, &buf[i], &terms[i], 0))
+            goto fail;
+        buf[i].next(&buf[i]);
+        live[i] = &buf[i];
+    }
+    num_live = sort_terms(live, num_terms);
+    if (!min_match)
+        min_match = 1;
+
+    while (k){
+        uint32_t threshold = min_match;
+        valueid_t pivot;
+
+        if (num_matches == k && matches[0].count >= threshold)
+            threshold = matches[0].count + 1;
+        if (num_live < threshold)
+            break;
+        pivot = live[threshold - 1]->cur_id;
+
+        if (live[0]->cur_id == pivot){
+            struct ddb_match m;
+            for (n = threshold; n < num_live && live[n]->cur_id == pivot;)
+                ++n;
+            m.id = pivot;
+            m.count = n;
+            if (num_matches < k){
+                matches[num_matches] = m;
+                sift_up(matches, num_matches++);
+            }else{
+                matches[0] = m;
+                sift_down(matches, k, 0);
+            }
+            for (i = 0; i < n; i++)
+                live[i]->next(live[i]);
+        }else
+            for (i = 0; i < threshold - 1; i++)
+                ddb_term_seek(live[i], pivot);
+        num_live = sort_terms(live, num_live);
+    }
+
+    /* best first */
+    for (n = num_matches; n > 1;){
+        struct ddb_match tmp = matches[0];
+        matches[0] = matches[--n];
+        matches[n] = tmp;
+        sift_down(matches, n, 0);
+    }
+    for (i = 0; i < num_terms; i++){
+        if (buf[i].next == ddb_union_next)
+            ddb_union_cursor_free(buf[i].cursor);
+        free(buf[i].cursor);
+    }
+    free(buf);
+    free(live);
+    return num_matches;
+oom:
+    ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+fail:
+    if (buf)
+        for (i = 0; i < num_terms; i++){
+            if (buf[i].next == ddb_union_next)
+                ddb_union_cursor_free(buf[i].cursor);
+            free(buf[i].cursor);
+        }
+    free(buf);
+    free(live);
+    return -1;
+}
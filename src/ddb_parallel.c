@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <discodb.h>
+#include <ddb_internal.h>
+
+/*
+ * Parallel queries split the value IDs [1, num_uniq_values] into equal
+ * ranges, chunks, each evaluated by a CNF cursor of its own that starts
+ * partway into the posting lists, see ddb_cnf_cursor_range().
+ *
+ * Worker threads take the chunks in order and collect their IDs. The
+ * consumer returns the chunks one after another, so the results come
+ * out in ID order as with a serial query. Workers stay at most
+ * CHUNKS_AHEAD chunks per thread ahead of the consumer, which bounds
+ * the memory taken by results that have not been returned yet.
+ */
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define MIN_CHUNK_SIZE 16384
+#define MAX_CHUNK_SIZE 1048576
+#define CHUNKS_PER_THREAD 4
+#define CHUNKS_AHEAD 2
+
+struct parallel_chunk{
+    struct ddb_cursor *cursor;
+    valueid_t *ids;
+    uint32_t num_ids;
+    int done;
+    int err;
+};
+
+struct ddb_parallel_cursor{
+    const struct ddb *db;
+    struct ddb_query_clause *clauses;
+    uint32_t num_clauses;
+    const struct ddb_view *view;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* a chunk may be started */
+    pthread_cond_t done; /* a chunk is done */
+    pthread_t *threads;
+    uint32_t num_threads;
+    uint32_t max_ahead; /* chunks started before cur_chunk is returned */
+    int stop;
+
+    struct parallel_chunk *chunks;
+    uint32_t num_chunks;
+    uint32_t chunk_size;
+    uint32_t next_chunk; /* next one to be started */
+    uint32_t cur_chunk; /* being returned */
+    uint32_t i; /* position in cur_chunk */
+    int ready; /* cur_chunk is done */
+    uint64_t offset;
+    uint64_t limit;
+};
+
+static uint32_t chunk_size(const struct ddb *db, uint32_t num_threads)
+{
+    uint64_t size = db->num_uniq_values / (num_threads * CHUNKS_PER_THREAD);
+    if (size < MIN_CHUNK_SIZE)
+        return MIN_CHUNK_SIZE;
+    if (size > MAX_CHUNK_SIZE)
+        return MAX_CHUNK_SIZE;
+    return size;
+}
+
+uint32_t ddb_parallel_num_chunks(const struct ddb *db, uint32_t num_threads)
+{
+    uint32_t size;
+    if (num_threads < 2)
+        return 1;
+    size = chunk_size(db, num_threads);
+    return (db->num_uniq_values + size - 1LLU) / size;
+}
+
+/* Workers build their cursors long after the query has returned, so
+   they need a copy of the clauses. */
+static struct ddb_query_clause *copy_clauses(
+        const struct ddb_query_clause *clauses,
+        uint32_t num_clauses)
+{
+    struct ddb_query_clause *copy;
+    struct ddb_query_term *terms;
+    uint64_t size = num_clauses * sizeof(struct ddb_query_clause);
+    uint32_t i, j, num_terms = 0;
+    char *p;
+
+    for (i = 0; i < num_clauses; i++){
+        num_terms += clauses[i].num_terms;
+        for (j = 0; j < clauses[i].num_terms; j++)
+            size += clauses[i].terms[j].key.length;
+    }
+    size += num_terms * sizeof(struct ddb_query_term);
+    if (!(copy = malloc(size)))
+        return NULL;
+
+    terms = (struct ddb_query_term*)&copy[num_clauses];
+    p = (char*)&terms[num_terms];
+    for (i = 0; i < num_clauses; i++){
+        copy[i].terms = terms;
+        copy[i].num_terms = clauses[i].num_terms;
+        for (j = 0; j < clauses[i].num_terms; j++){
+            *terms = clauses[i].terms[j];
+            memcpy(p, terms->key.data, terms->key.length);
+            terms->key.data = p;
+            p += terms++->key.length;
+        }
+    }
+    return copy;
+}
+
+static int collect_ids(struct parallel_chunk *chunk)
+{
+    uint32_t size = 0;
+    int err = 0;
+
+    while (chunk->num_ids == size){
+        valueid_t *ids;
+        size = size ? size * 2: 1024;
+        if (!(ids = realloc(chunk->ids, size * sizeof(valueid_t))))
+            return DDB_ERR_OUT_OF_MEMORY;
+        chunk->ids = ids;
+        chunk->num_ids += ddb_next_id_batch(chunk->cursor,
+                                            &chunk->ids[chunk->num_ids],
+                                            size - chunk->num_ids,
+                                            &err);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+static void run_chunk(struct ddb_parallel_cursor *p, uint32_t k)
+{
+    struct parallel_chunk *chunk = &p->chunks[k];
+    valueid_t start = 1 + k * p->chunk_size;
+
+    /* the cursor of the first chunk is made by ddb_parallel_new() */
+    if (!chunk->cursor)
+        chunk->cursor = ddb_query_range(p->db, p->clauses, p->num_clauses,
+                                        p->view, start,
+                                        start + (uint64_t)p->chunk_size, 0);
+    if (!chunk->cursor)
+        chunk->err = DDB_ERR_OUT_OF_MEMORY;
+    else
+        chunk->err = collect_ids(chunk);
+    ddb_free_cursor(chunk->cursor);
+    chunk->cursor = NULL;
+}
+
+static void *worker(void *arg)
+{
+    struct ddb_parallel_cursor *p = (struct ddb_parallel_cursor*)arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop && p->next_chunk < p->num_chunks){
+        uint32_t k = p->next_chunk;
+        if (k >= p->cur_chunk + p->max_ahead){
+            pthread_cond_wait(&p->work, &p->lock);
+            continue;
+        }
+        ++p->next_chunk;
+        pthread_mutex_unlock(&p->lock);
+        run_chunk(p, k);
+        pthread_mutex_lock(&p->lock);
+        p->chunks[k].done = 1;
+        pthread_cond_broadcast(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+struct ddb_parallel_cursor *ddb_parallel_new(
+        const struct ddb *db,
+        const struct ddb_query_clause *clauses,
+        uint32_t num_clauses,
+        const struct ddb_query_opts *opts)
+{
+    struct ddb_parallel_cursor *p;
+    uint32_t i;
+
+    if (!(p = calloc(1, sizeof(struct ddb_parallel_cursor))))
+        return NULL;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->db = db;
+    p->num_clauses = num_clauses;
+    p->view = opts->view;
+    p->offset = opts->offset;
+    p->limit = opts->limit ? opts->limit: UINT64_MAX;
+    p->chunk_size = chunk_size(db, opts->num_threads);
+    p->num_chunks = ddb_parallel_num_chunks(db, opts->num_threads);
+    p->max_ahead = opts->num_threads * CHUNKS_AHEAD;
+
+    if (!(p->clauses = copy_clauses(clauses, num_clauses)))
+        goto err;
+    if (!(p->chunks = calloc(p->num_chunks, sizeof(struct parallel_chunk))))
+        goto err;
+    if (!(p->threads = calloc(opts->num_threads, sizeof(pthread_t))))
+        goto err;
+    /* only the first chunk reads ahead, as it is the one that is
+       waited for first */
+    if (!(p->chunks[0].cursor = ddb_query_range(db, clauses, num_clauses,
+                                                p->view, 1,
+                                                1 + (uint64_t)p->chunk_size,
+                                                1)))
+        goto err;
+
+    for (i = 0; i < opts->num_threads && i < p->num_chunks; i++){
+        if (pthread_create(&p->threads[i], NULL, worker, p))
+            break;
+        ++p->num_threads;
+    }
+    if (!p->num_threads)
+        goto err;
+    return p;
+err:
+    ddb_parallel_free(p);
+    return NULL;
+}
+
+void ddb_parallel_free(struct ddb_parallel_cursor *p)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < p->num_threads; i++)
+        pthread_join(p->threads[i], NULL);
+
+    if (p->chunks)
+        for (i = 0; i < p->num_chunks; i++){
+            ddb_free_cursor(p->chunks[i].cursor);
+            free(p->chunks[i].ids);
+        }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    free(p->chunks);
+    free(p->threads);
+    free(p->clauses);
+    free(p);
+}
+
+const struct ddb_entry *ddb_parallel_cursor_next(struct ddb_cursor *c)
+{
+    struct ddb_parallel_cursor *p = c->cursor.parallel;
+
+    while (p->limit && p->cur_chunk < p->num_chunks){
+        struct parallel_chunk *chunk = &p->chunks[p->cur_chunk];
+        if (!p->ready){
+            pthread_mutex_lock(&p->lock);
+            while (!chunk->done)
+                pthread_cond_wait(&p->done, &p->lock);
+            pthread_mutex_unlock(&p->lock);
+            if (chunk->err){
+                c->errno = chunk->err;
+                return NULL;
+            }
+            p->ready = 1;
+        }
+        if (p->offset){
+            uint64_t n = MIN(p->offset, chunk->num_ids - p->i);
+            p->i += n;
+            p->offset -= n;
+        }
+        if (p->i < chunk->num_ids){
+            --p->limit;
+            if (ddb_get_valuestr(c, chunk->ids[p->i++]))
+                return NULL;
+            return &c->entry;
+        }
+
+        free(chunk->ids);
+        chunk->ids = NULL;
+        p->i = p->ready = 0;
+        pthread_mutex_lock(&p->lock);
+        ++p->cur_chunk;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <discodb.h>
+#include <ddb_internal.h>
+
+/*
+ * Query strings follow the syntax of Q.parse() in the Python module:
+ *
+ *   or    := and ('|' and)*
+ *   and   := unary ('&' unary)*
+ *   unary := '~' unary | '*' unary | '+' unary | '(' or ')' | key
+ *
+ * A key is a run of characters other than &|~*+(), without the spaces
+ * around it. '*' and '+' are the same operator: it matches the values
+ * of the keys that its argument matches as values. An empty query
+ * matches nothing.
+ *
+ * Keys are looked up and dereferences evaluated when the query is
+ * prepared, so that running it only opens the posting lists. The
+ * cursors don't refer to the prepared query once created.
+ */
+
+struct ddb_prepared{
+    const struct ddb *db;
+    const struct ddb_expr *root;
+    struct ddb_expr *nodes;
+    const struct ddb_expr **args;
+    keyid_t *key_ids;
+    /* the keys that the dereferences matched */
+    keyid_t **lists;
+    uint32_t num_lists;
+    /* the query as clauses, if it is in CNF */
+    struct ddb_query_clause *clauses;
+    uint32_t num_clauses;
+    int cnf;
+};
+
+struct parser{
+    struct ddb_prepared *q;
+    const char *p;
+    const char *end;
+    uint32_t num_nodes;
+    uint32_t num_args;
+    uint32_t num_keys;
+    int err;
+};
+
+static int is_special(char c)
+{
+    return c && strchr("&|~*+()", c) != NULL;
+}
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Returns the next character that is not a space, -1 at the end. */
+static int peek(struct parser *s)
+{
+    while (s->p < s->end && is_space(*s->p))
+        ++s->p;
+    return s->p < s->end ? (unsigned char)*s->p: -1;
+}
+
+static struct ddb_expr *new_node(struct parser *s, int op)
+{
+    struct ddb_expr *e = &s->q->nodes[s->num_nodes++];
+    e->op = op;
+    return e;
+}
+
+/* Evaluates the argument of a dereference and replaces it with a term
+   of the keys that its values name. */
+static struct ddb_expr *deref(struct parser *s, struct ddb_expr *arg)
+{
+    const struct ddb *db = s->q->db;
+    const struct ddb_entry *e;
+    struct ddb_cursor *c;
+    struct ddb_expr *node;
+    keyid_t *ids = NULL;
+    uint32_t n = 0, size = 0;
+    int err = 0;
+
+    /* the error is set by the sub-query */
+    if (!(c = ddb_query_expr(db, arg, NULL))){
+        s->err = ddb_error(db, NULL);
+        return NULL;
+    }
+    while ((e = ddb_next(c, &err))){
+        keyid_t id = ddb_key_id(db, e);
+        if (id == db->num_keys)
+            continue;
+        if (n == size){
+            keyid_t *p;
+            size = size ? size * 2: 16;
+            if (!(p = realloc(ids, size * sizeof(keyid_t))))
+                goto err;
+            ids = p;
+        }
+        ids[n++] = id;
+    }
+    if (err)
+        goto err;
+    ddb_free_cursor(c);
+
+    s->q->lists[s->q->num_lists++] = ids;
+
+    node = new_node(s, DDB_EXPR_TERM);
+    node->term.type = DDB_TERM_META_IDS;
+    node->term.key.data = (const char*)ids;
+    node->term.key.length = n * sizeof(keyid_t);
+    return node;
+err:
+    free(ids);
+    ddb_free_cursor(c);
+    s->err = DDB_ERR_OUT_OF_MEMORY;
+    return NULL;
+}
+
+static struct ddb_expr *key(struct parser *s)
+{
+    const struct ddb *db = s->q->db;
+    const char *start = s->p;
+    struct ddb_entry k;
+    struct ddb_expr *node;
+    keyid_t *id;
+
+    while (s->p < s->end && !is_special(*s->p))
+        ++s->p;
+    k.data = start;
+    k.length = s->p - start;
+    while (k.length && is_space(k.data[k.length - 1]))
+        --k.length;
+    if (!k.length){
+        s->err = DDB_ERR_INVALID_QUERY;
+        return NULL;
+    }
+
+    id = &s->q->key_ids[s->num_keys++];
+    *id = ddb_key_id(db, &k);
+    node = new_node(s, DDB_EXPR_TERM);
+    node->term.type = DDB_TERM_KEY_ID;
+    node->term.key.data = (const char*)id;
+    node->term.key.length = sizeof(keyid_t);
+    return node;
+}
+
+static struct ddb_expr *parse_or(struct parser *s);
+
+static struct ddb_expr *parse_unary(struct parser *s)
+{
+    struct ddb_expr *arg, *node;
+
+    switch (peek(s)){
+        case '~':
+            ++s->p;
+            if (!(arg = parse_unary(s)))
+                return NULL;
+            node = new_node(s, DDB_EXPR_NOT);
+            s->q->args[s->num_args] = arg;
+            node->args = &s->q->args[s->num_args++];
+            node->num_args = 1;
+            return node;
+        case '*':
+        case '+':
+            ++s->p;
+            if (!(arg = parse_unary(s)))
+                return NULL;
+            return deref(s, arg);
+        case '(':
+            ++s->p;
+            if (!(arg = parse_or(s)))
+                return NULL;
+            if (peek(s) != ')'){
+                s->err = DDB_ERR_INVALID_QUERY;
+                return NULL;
+            }
+            ++s->p;
+            return arg;
+        case -1:
+        case '&':
+        case '|':
+        case ')':
+            s->err = DDB_ERR_INVALID_QUERY;
+            return NULL;
+    }
+    return key(s);
+}
+
+/* Parses operands separated by sep into a single node. The arguments
+   are collected first, as nested operands take arguments too. */
+static struct ddb_expr *parse_list(struct parser *s,
+                                   int op,
+                                   char sep,
+                                   struct ddb_expr *(*operand)(struct parser*))
+{
+    struct ddb_expr *arg, *node = NULL;
+    struct ddb_expr **args = NULL;
+    uint32_t n = 0, size = 0;
+
+    if (!(arg = operand(s)))
+        return NULL;
+    if (peek(s) != sep)
+        return arg;
+    do{
+        if (n == size){
+            struct ddb_expr **p;
+            size = size ? size * 2: 8;
+            if (!(p = realloc(args, size * sizeof(struct ddb_expr*)))){
+                s->err = DDB_ERR_OUT_OF_MEMORY;
+                goto end;
+            }
+            args = p;
+        }
+        args[n++] = arg;
+        if (peek(s) != sep)
+            break;
+        ++s->p;
+    }while ((arg = operand(s)));
+    if (s->err)
+        goto end;
+
+    node = new_node(s, op);
+    node->args = &s->q->args[s->num_args];
+    node->num_args = n;
+    memcpy(&s->q->args[s->num_args], args, n * sizeof(struct ddb_expr*));
+    s->num_args += n;
+end:
+    free(args);
+    return node;
+}
+
+static struct ddb_expr *parse_and(struct parser *s)
+{
+    return parse_list(s, DDB_EXPR_AND, '&', parse_unary);
+}
+
+static struct ddb_expr *parse_or(struct parser *s)
+{
+    return parse_list(s, DDB_EXPR_OR, '|', parse_and);
+}
+
+struct ddb_prepared *ddb_prepare(const struct ddb *db,
+                                 const char *query,
+                                 uint64_t length)
+{
+    struct ddb_prepared *q;
+    struct parser s;
+    /* every node takes at least one character */
+    uint64_t size = length + 1;
+
+    memset(&s, 0, sizeof(s));
+    if (!(q = s.q = calloc(1, sizeof(struct ddb_prepared))))
+        goto err;
+    q->db = db;
+    if (!(q->nodes = calloc(size, sizeof(struct ddb_expr))))
+        goto err;
+    if (!(q->args = malloc(size * sizeof(struct ddb_expr*))))
+        goto err;
+    if (!(q->key_ids = malloc(size * sizeof(keyid_t))))
+        goto err;
+    if (!(q->lists = malloc(size * sizeof(keyid_t*))))
+        goto err;
+    s.p = query;
+    s.end = query + length;
+
+    if (peek(&s) == -1){
+        q->cnf = 1;
+        return q;
+    }
+    if (!(q->root = parse_or(&s)))
+        goto fail;
+    if (peek(&s) != -1){
+        s.err = DDB_ERR_INVALID_QUERY;
+        goto fail;
+    }
+    switch (ddb_expr_clauses(q->root, &q->clauses, &q->num_clauses)){
+        case -1:
+            goto err;
+        case 1:
+            q->cnf = 1;
+    }
+    return q;
+err:
+    s.err = DDB_ERR_OUT_OF_MEMORY;
+fail:
+    ddb_set_error(db, s.err);
+    ddb_prepared_free(q);
+    return NULL;
+}
+
+struct ddb_cursor *ddb_prepared_query(const struct ddb_prepared *prepared,
+                                      const struct ddb_query_opts *opts)
+{
+    static const struct ddb_query_opts defaults;
+
+    if (!opts)
+        opts = &defaults;
+    if (prepared->cnf)
+        return ddb_query_with_opts(prepared->db,
+                                   prepared->clauses,
+                                   prepared->num_clauses,
+                                   opts);
+    return ddb_query_expr(prepared->db, prepared->root, opts);
+}
+
+void ddb_prepared_free(struct ddb_prepared *prepared)
+{
+    uint32_t i;
+    if (prepared){
+        for (i = 0; i < prepared->num_lists; i++)
+            free(prepared->lists[i]);
+        free(prepared->lists);
+        free(prepared->key_ids);
+        free(prepared->args);
+        free(prepared->nodes);
+        free(prepared->clauses);
+        free(prepared);
+    }
+}
@@ -1,9 +1,20 @@
-
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <ddb_internal.h>
 #include <ddb_map.h>
 
+static struct ddb_view *array_view(uint32_t size)
+{
+    struct ddb_view *view;
+    if (!(view = calloc(1, sizeof(struct ddb_view) + size * sizeof(valueid_t))))
+        return NULL;
+    view->values = view->buf;
+    return view;
+}
+
 struct ddb_view_cons *ddb_view_cons_new()
 {
     struct ddb_view_cons *cons;
@@ -22,24 +33,63 @@ int ddb_view_cons_add(const struct ddb_view_cons *cons,
     return ddb_map_insert_str(cons->map, value) == NULL;
 }
 
+static int id_cmp(const void *p1, const void *p2)
+{
+    const valueid_t x = *(const valueid_t*)p1;
+    const valueid_t y = *(const valueid_t*)p2;
+
+    if (x > y)
+        return 1;
+    else if (x < y)
+        return -1;
+    return 0;
+}
+
+/* With a value index, only the values in the view are looked up. */
+static struct ddb_view *indexed_view(const struct ddb_view_cons *cons,
+                                     const struct ddb *db)
+{
+    struct ddb_map_cursor *c;
+    struct ddb_view *view;
+    struct ddb_entry value;
+    valueid_t id;
+
+    if (!(view = array_view(ddb_map_num_items(cons->map))))
+        return NULL;
+    if (!(c = ddb_map_cursor_new(cons->map))){
+        free(view);
+        return NULL;
+    }
+    while (ddb_map_next_str(c, &value))
+        if ((id = ddb_value_id(db, &value)))
+            view->buf[view->num_values++] = id;
+    ddb_map_cursor_free(c);
+    qsort(view->buf, view->num_values, sizeof(valueid_t), id_cmp);
+    return view;
+}
+
 struct ddb_view *ddb_view_cons_finalize(const struct ddb_view_cons *cons,
                                         struct ddb *db)
 {
     uint32_t n = ddb_map_num_items(cons->map);
-    struct ddb_cursor *cursor = ddb_unique_values(db);
-    struct ddb_view *view = malloc(4 + n * sizeof(valueid_t));
+    struct ddb_cursor *cursor = NULL;
+    struct ddb_view *view = NULL;
     const struct ddb_entry *value;
     valueid_t id = 0;
     int err = 0;
 
+    if (db->value_index)
+        return indexed_view(cons, db);
+
+    cursor = ddb_unique_values(db);
+    view = array_view(n);
     if (!(cursor && view))
         goto err;
 
-    view->num_values = 0;
     while (n && (value = ddb_next(cursor, &err))){
         ++id;
         if (ddb_map_lookup_str(cons->map, value)){
-            view->values[view->num_values++] = id;
+            view->buf[view->num_values++] = id;
             --n;
         }
     }
@@ -61,8 +111,56 @@ void ddb_view_cons_free(struct ddb_view_cons *cons)
     }
 }
 
+/* Builds a view of the value IDs of a cursor without looking at any
+   values. Query results come out in ID order already, results of
+   other cursors are sorted here. */
+struct ddb_view *ddb_query_to_view(struct ddb_cursor *c)
+{
+    uint32_t i, n = 0, size = c->num_items ? c->num_items: 1024;
+    struct ddb_view *view, *tmp;
+    int sorted = 1, err;
+    valueid_t id;
+
+    /* key IDs are no value IDs */
+    if (c->key_results){
+        ddb_set_error(c->db, DDB_ERR_QUERY_NOT_SUPPORTED);
+        return NULL;
+    }
+    if (!(view = array_view(size)))
+        goto err;
+    while ((id = ddb_next_id(c, &err))){
+        if (n == size){
+            size = size > UINT32_MAX / 2 ? UINT32_MAX: size * 2;
+            if (!(tmp = realloc(view, sizeof(struct ddb_view) +
+                                      size * sizeof(valueid_t))))
+                goto err;
+            view = tmp;
+        }
+        if (n && id < view->buf[n - 1])
+            sorted = 0;
+        view->buf[n++] = id;
+    }
+    if (err)
+        goto err;
+
+    view->values = view->buf;
+    if (!sorted)
+        qsort(view->buf, n, sizeof(valueid_t), id_cmp);
+    /* multisets repeat IDs */
+    for (i = 0; i < n; i++)
+        if (!i || view->buf[i] != view->buf[i - 1])
+            view->buf[view->num_values++] = view->buf[i];
+    return view;
+err:
+    free(view);
+    ddb_set_error(c->db, DDB_ERR_OUT_OF_MEMORY);
+    return NULL;
+}
+
 void ddb_view_free(struct ddb_view *view)
 {
+    if (view && view->mmap)
+        munmap(view->mmap, view->mmap_size);
     free(view);
 }
 
@@ -70,3 +168,137 @@ uint32_t ddb_view_size(const struct ddb_view *view)
 {
     return view->num_values;
 }
+
+static uint64_t values_size(const struct ddb *db)
+{
+    return db->id2value[db->num_uniq_values] - db->id2value[0];
+}
+
+static int write_all(int fd, const void *data, uint64_t size)
+{
+    const char *p = (const char*)data;
+    while (size){
+        ssize_t n = write(fd, p, size);
+        if (n == -1)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int ddb_view_dump(const struct ddb_view *view, const struct ddb *db, int fd)
+{
+    const uint64_t num_bits = db->num_uniq_values + 1LLU;
+    const uint64_t num_words = (num_bits + 63) >> 6;
+    struct ddb_view_header head;
+    uint64_t *bitmap = NULL;
+    int ret = -1;
+    uint32_t i;
+
+    if ((view->bitmap && view->num_bits != num_bits) ||
+        (view->values && view->num_values &&
+         view->values[view->num_values - 1] >= num_bits)){
+        ddb_set_error(db, DDB_ERR_INVALID_VIEW);
+        return -1;
+    }
+    memset(&head, 0, sizeof(head));
+    head.magic = DDB_VIEW_MAGIC;
+    head.values_size = values_size(db);
+    head.num_uniq_values = db->num_uniq_values;
+    head.num_values = view->num_values;
+    head.format = view->bitmap ||
+                  num_words * sizeof(uint64_t) <
+                  view->num_values * (uint64_t)sizeof(valueid_t) ?
+                  VIEW_BITMAP: VIEW_ARRAY;
+
+    if (head.format == VIEW_BITMAP && !view->bitmap){
+        if (!(bitmap = calloc(num_words, sizeof(uint64_t)))){
+            ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+            return -1;
+        }
+        for (i = 0; i < view->num_values; i++)
+            bitmap[view->values[i] >> 6] |= 1ULL << (view->values[i] & 63);
+    }
+    if (write_all(fd, &head, sizeof(head)))
+        goto end;
+    if (head.format == VIEW_BITMAP){
+        if (write_all(fd, bitmap ? bitmap: view->bitmap,
+                      num_words * sizeof(uint64_t)))
+            goto end;
+    }else if (write_all(fd, view->values,
+                        view->num_values * (uint64_t)sizeof(valueid_t)))
+        goto end;
+    ret = 0;
+end:
+    if (ret)
+        ddb_set_error(db, DDB_ERR_WRITEFAILED);
+    free(bitmap);
+    return ret;
+}
+
+/* Maps a view written by ddb_view_dump(). The view must have been
+   made for a db with the same value IDs. */
+struct ddb_view *ddb_view_load(const struct ddb *db, int fd)
+{
+    const uint64_t num_bits = db->num_uniq_values + 1LLU;
+    const uint64_t num_words = (num_bits + 63) >> 6;
+    const struct ddb_view_header *head;
+    struct ddb_view *view;
+    struct stat nfo;
+    const char *data;
+    uint64_t size;
+    int err = DDB_ERR_INVALID_VIEW;
+
+    if (fstat(fd, &nfo)){
+        ddb_set_error(db, DDB_ERR_STAT_FAILED);
+        return NULL;
+    }
+    if (!(view = calloc(1, sizeof(struct ddb_view)))){
+        ddb_set_error(db, DDB_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    if (nfo.st_size < 0 ||
+            (uint64_t)nfo.st_size < sizeof(struct ddb_view_header))
+        goto err;
+    view->mmap_size = nfo.st_size;
+    view->mmap = mmap(0, view->mmap_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (view->mmap == MAP_FAILED){
+        view->mmap = NULL;
+        err = DDB_ERR_MMAP_FAILED;
+        goto err;
+    }
+
+    head = (const struct ddb_view_header*)view->mmap;
+    data = (const char*)view->mmap + sizeof(struct ddb_view_header);
+    size = view->mmap_size - sizeof(struct ddb_view_header);
+    if (head->magic != DDB_VIEW_MAGIC ||
+        head->num_uniq_values != db->num_uniq_values ||
+        head->values_size != values_size(db))
+        goto err;
+    view->num_values = head->num_values;
+
+    if (head->format == VIEW_ARRAY){
+        if (size != view->num_values * (uint64_t)sizeof(valueid_t))
+            goto err;
+        view->values = (const valueid_t*)data;
+        if (view->num_values && (!view->values[0] ||
+                view->values[view->num_values - 1] >= num_bits))
+            goto err;
+    }else if (head->format == VIEW_BITMAP){
+        uint64_t tail = num_bits & 63 ? (1ULL << (num_bits & 63)) - 1: ~0ULL;
+        if (size != num_words * sizeof(uint64_t))
+            goto err;
+        view->bitmap = (const uint64_t*)data;
+        view->num_bits = num_bits;
+        /* there is no value with ID 0 */
+        if ((view->bitmap[0] & 1) || (view->bitmap[num_words - 1] & ~tail))
+            goto err;
+    }else
+        goto err;
+    return view;
+err:
+    ddb_view_free(view);
+    ddb_set_error(db, err);
+    return NULL;
+}
@@ -17,17 +17,74 @@
 #define DDB_ERR_STAT_FAILED 6
 #define DDB_ERR_MMAP_FAILED 7
 #define DDB_ERR_WRITEFAILED 8
+#define DDB_ERR_INVALID_ID 9
+#define DDB_ERR_MLOCK_FAILED 10
+#define DDB_ERR_INVALID_VIEW 11
+#define DDB_ERR_INVALID_QUERY 12
 
 #define DDB_OPT_DISABLE_COMPRESSION 1
 #define DDB_OPT_UNIQUE_ITEMS 2
+#define DDB_OPT_VALUE_INDEX 4
+#define DDB_OPT_INVERTED 8
+#define DDB_OPT_SORTED_KEYS 16
+#define DDB_OPT_SKIPS 32
+
+#define DDB_LOAD_POPULATE 1
+#define DDB_LOAD_MLOCK 2
+#define DDB_LOAD_HUGEPAGES 4
+#define DDB_LOAD_RANDOM 8
+#define DDB_LOAD_SEQUENTIAL 16
+#define DDB_LOAD_QUERY_READAHEAD 32
+
+#define DDB_SECTION_HASH 1
+#define DDB_SECTION_KEY2VALUES 2
+#define DDB_SECTION_ITEMS 4
+#define DDB_SECTION_ID2VALUE 8
+#define DDB_SECTION_VALUES 16
+#define DDB_SECTION_CODEBOOK 32
+#define DDB_SECTION_SKIPS 64
+#define DDB_SECTION_VALUE_INDEX 128
+#define DDB_SECTION_INVERTED 256
+#define DDB_SECTION_KEY_INDEX 512
+#define DDB_SECTION_INDEX (DDB_SECTION_HASH | DDB_SECTION_KEY2VALUES |\
+                           DDB_SECTION_ID2VALUE | DDB_SECTION_CODEBOOK |\
+                           DDB_SECTION_SKIPS | DDB_SECTION_KEY_INDEX)
+#define DDB_SECTION_ALL 1023
+
+#define DDB_ADVICE_NORMAL 0
+#define DDB_ADVICE_RANDOM 1
+#define DDB_ADVICE_SEQUENTIAL 2
+#define DDB_ADVICE_WILLNEED 3
+#define DDB_ADVICE_DONTNEED 4
+
+#define DDB_PLAN_EMPTY 0
+#define DDB_PLAN_BITMAP 1
+#define DDB_PLAN_MERGE 2
+
+#define DDB_MULTIPLICITY_NONE 0
+#define DDB_MULTIPLICITY_MIN 1
+#define DDB_MULTIPLICITY_SUM 2
+
+#define DDB_TERM_KEY 0
+#define DDB_TERM_VALUE 1
+#define DDB_TERM_PREFIX 2
+#define DDB_TERM_GLOB 3
+#define DDB_TERM_META 4
+
+#define DDB_EXPR_TERM 0
+#define DDB_EXPR_AND 1
+#define DDB_EXPR_OR 2
+#define DDB_EXPR_NOT 3
 
 struct ddb_cons;
 struct ddb;
 struct ddb_cursor;
 struct ddb_view_cons;
 struct ddb_view;
+struct ddb_cache;
+struct ddb_prepared;
 
-typedef uint64_t ddb_features_t[9];
+typedef uint64_t ddb_features_t[10];
 
 enum ddb_features{
     DDB_NUM_KEYS,
@@ -40,7 +97,9 @@ enum ddb_features{
 
     DDB_IS_COMPRESSED,
     DDB_IS_HASHED,
-    DDB_IS_MULTISET
+    DDB_IS_MULTISET,
+
+    DDB_MAX_VALUE_SIZE
 };
 
 struct ddb_entry{
@@ -48,9 +107,14 @@ struct ddb_entry{
     uint32_t length;
 };
 
+struct ddb_query_clause;
+
 struct ddb_query_term{
     struct ddb_entry key;
     int nnot;
+    int type;
+    const struct ddb_query_clause *clauses;
+    uint32_t num_clauses;
 };
 
 struct ddb_query_clause{
@@ -58,8 +122,35 @@ struct ddb_query_clause{
     uint32_t num_terms;
 };
 
+struct ddb_expr{
+    int op;
+    struct ddb_query_term term;
+    const struct ddb_expr **args;
+    uint32_t num_args;
+};
+
+struct ddb_query_opts{
+    uint64_t offset;
+    uint64_t limit;
+    const struct ddb_view *view;
+    uint32_t num_threads;
+};
+
+struct ddb_match{
+    uint32_t id;
+    uint32_t count;
+};
+
+struct ddb_cache_stats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t num_entries;
+    uint64_t size;
+};
+
 struct ddb_cons *ddb_cons_new(void);
-struct ddb_cons *ddb_cons_ddb(struct ddb *db);
+struct ddb_cons *ddb_cons_ddb(const struct ddb *db);
 void ddb_cons_free(struct ddb_cons *cons);
 
 int ddb_cons_add(struct ddb_cons *db,
@@ -70,27 +161,78 @@ char *ddb_cons_finalize(struct ddb_cons *cons, uint64_t *length, uint64_t flags)
 struct ddb *ddb_new(void);
 int ddb_load(struct ddb *db, int fd);
 int ddb_loado(struct ddb *db, int fd, off_t);
+int ddb_load_flags(struct ddb *db, int fd, off_t offset, uint32_t flags);
 int ddb_loads(struct ddb *db, const char *data, uint64_t length);
-int ddb_dump(struct ddb *db, int fd);
-char *ddb_dumps(struct ddb *db, uint64_t *length);
+int ddb_dump(const struct ddb *db, int fd);
+char *ddb_dumps(const struct ddb *db, uint64_t *length);
 
 void ddb_features(const struct ddb *db, ddb_features_t features);
+int ddb_advise(const struct ddb *db, uint32_t sections, int advice);
+uint64_t ddb_prewarm(const struct ddb *db, uint32_t sections);
 
-struct ddb_cursor *ddb_keys(struct ddb *db);
-struct ddb_cursor *ddb_values(struct ddb *db);
-struct ddb_cursor *ddb_unique_values(struct ddb *db);
-struct ddb_cursor *ddb_getitem(struct ddb *db,
+struct ddb_cursor *ddb_keys(const struct ddb *db);
+struct ddb_cursor *ddb_keys_range(const struct ddb *db,
+    uint32_t start_key_id, uint32_t end_key_id);
+struct ddb_cursor *ddb_keys_prefix(const struct ddb *db,
+    const struct ddb_entry *prefix);
+struct ddb_cursor *ddb_keys_between(const struct ddb *db,
+    const struct ddb_entry *lo, const struct ddb_entry *hi);
+struct ddb_cursor *ddb_values(const struct ddb *db);
+struct ddb_cursor *ddb_values_range(const struct ddb *db,
+    uint32_t start_key_id, uint32_t end_key_id);
+uint32_t ddb_partition(const struct ddb *db, uint32_t num_parts,
+    uint32_t *bounds);
+uint32_t ddb_value_id(const struct ddb *db, const struct ddb_entry *value);
+struct ddb_cursor *ddb_unique_values(const struct ddb *db);
+struct ddb_cursor *ddb_getitem(const struct ddb *db,
     const struct ddb_entry *key);
-struct ddb_cursor *ddb_query(struct ddb *db,
+struct ddb_cursor *ddb_getkeys(const struct ddb *db,
+    const struct ddb_entry *value);
+struct ddb_cursor *ddb_query(const struct ddb *db,
     const struct ddb_query_clause *clauses, uint32_t num_clauses);
+struct ddb_cursor *ddb_values_by_id(const struct ddb *db,
+    const uint32_t *ids, uint32_t num_ids);
+
+uint32_t ddb_num_unique_values(const struct ddb *db);
+int ddb_value_by_id(const struct ddb *db, uint32_t id,
+    struct ddb_entry *value, char *buf, uint64_t size);
 
 void ddb_free(struct ddb *db);
 int ddb_error(const struct ddb *db, const char **errstr);
+const char *ddb_strerror(int err);
 int ddb_free_cursor(struct ddb_cursor *cur);
 int ddb_notfound(const struct ddb_cursor *c);
 const struct ddb_entry *ddb_next(struct ddb_cursor *cur, int *errcode);
+const struct ddb_entry *ddb_next_into(struct ddb_cursor *cur,
+    char *buf, uint64_t size, int *errcode);
+uint32_t ddb_nextv(struct ddb_cursor *cur, struct ddb_entry *entries,
+    uint32_t num, char *buf, uint64_t size, int *errcode);
+uint32_t ddb_next_batch(struct ddb_cursor *cur, struct ddb_entry *entries,
+    uint32_t max, int *errcode);
+uint32_t ddb_next_id(struct ddb_cursor *cur, int *errcode);
+uint32_t ddb_next_id_batch(struct ddb_cursor *cur, uint32_t *ids,
+    uint32_t max, int *errcode);
 uint64_t ddb_resultset_size(const struct ddb_cursor *cur);
 uint64_t ddb_cursor_count(struct ddb_cursor *c, int *err);
+struct ddb_cursor *ddb_query_with_opts(const struct ddb *db,
+    const struct ddb_query_clause *clauses, uint32_t num_clauses,
+    const struct ddb_query_opts *opts);
+struct ddb_cursor *ddb_query_expr(const struct ddb *db,
+    const struct ddb_expr *expr, const struct ddb_query_opts *opts);
+uint64_t ddb_query_count(const struct ddb *db,
+    const struct ddb_query_clause *clauses, uint32_t num_clauses,
+    int *errcode);
+int ddb_readahead_stats(const struct ddb_cursor *c,
+    uint64_t *resident_pages, uint64_t *fetched_pages);
+int ddb_query_plan(const struct ddb_cursor *c, char *buf, uint64_t size);
+int ddb_cursor_multiplicity(struct ddb_cursor *c, int mode);
+uint32_t ddb_multiplicity(const struct ddb_cursor *c);
+int ddb_facet_counts(struct ddb_cursor *query,
+    const struct ddb_entry *facets, uint32_t num_facets,
+    uint64_t *counts, uint32_t *top, uint32_t k);
+int ddb_query_min_match(const struct ddb *db,
+    const struct ddb_query_term *terms, uint32_t num_terms,
+    uint32_t min_match, struct ddb_match *matches, uint32_t k);
 
 struct ddb_view_cons *ddb_view_cons_new(void);
 int ddb_view_cons_add(const struct ddb_view_cons *cons,
@@ -100,11 +242,28 @@ struct ddb_view *ddb_view_cons_finalize(const struct ddb_view_cons *cons,
 void ddb_view_cons_free(struct ddb_view_cons *cons);
 
 void ddb_view_free(struct ddb_view *view);
-struct ddb_cursor *ddb_query_view(struct ddb *db,
+struct ddb_cursor *ddb_query_view(const struct ddb *db,
                                   const struct ddb_query_clause *clauses,
                                   uint32_t num_clauses,
                                   const struct ddb_view *view);
 uint32_t ddb_view_size(const struct ddb_view *view);
+struct ddb_view *ddb_query_to_view(struct ddb_cursor *c);
+int ddb_view_dump(const struct ddb_view *view, const struct ddb *db, int fd);
+struct ddb_view *ddb_view_load(const struct ddb *db, int fd);
+
+struct ddb_cache *ddb_cache_new(uint64_t max_size);
+void ddb_cache_free(struct ddb_cache *cache);
+/* a cache may be shared by dbs and outlive them, results are kept
+   apart by the load they came from */
+void ddb_set_cache(struct ddb *db, struct ddb_cache *cache);
+void ddb_cache_stats(struct ddb_cache *cache, struct ddb_cache_stats *stats);
+
+struct ddb_prepared *ddb_prepare(const struct ddb *db,
+                                 const char *query,
+                                 uint64_t length);
+struct ddb_cursor *ddb_prepared_query(const struct ddb_prepared *prepared,
+                                      const struct ddb_query_opts *opts);
+void ddb_prepared_free(struct ddb_prepared *prepared);
 
 
 
@@ -60,6 +60,10 @@ int main(int argc, char **argv)
 
     flags |= getenv("DONT_COMPRESS") ? DDB_OPT_DISABLE_COMPRESSION: 0;
     flags |= getenv("UNIQUE_ITEMS") ? DDB_OPT_UNIQUE_ITEMS: 0;
+    flags |= getenv("VALUE_INDEX") ? DDB_OPT_VALUE_INDEX: 0;
+    flags |= getenv("INVERTED") ? DDB_OPT_INVERTED: 0;
+    flags |= getenv("SORTED_KEYS") ? DDB_OPT_SORTED_KEYS: 0;
+    flags |= getenv("SKIPS") ? DDB_OPT_SKIPS: 0;
 
     if (!db){
             fprintf(stderr, "DB init failed\n");
@@ -0,0 +1,207 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <discodb.h>
+
+/* Runs ddb_getitem() and ddb_query() lookups from 1..N threads
+   sharing a single db, checks every result against a single-threaded
+   reference run and reports how the throughput scales. */
+
+#define MAX_KEYS 10000
+
+struct bench{
+    pthread_t tid;
+    struct ddb *db;
+    int query;
+    uint32_t seed;
+    uint64_t num_ops;
+    int failed;
+};
+
+static struct ddb_entry keys[MAX_KEYS];
+static uint64_t *item_counts;
+static uint64_t *query_counts;
+static uint32_t num_keys;
+
+static uint64_t count(struct ddb_cursor *cur)
+{
+    uint64_t n = 0;
+    int err = 0;
+    if (!cur)
+        return -1;
+    while (ddb_next(cur, &err))
+        ++n;
+    ddb_free_cursor(cur);
+    return err ? (uint64_t)-1: n;
+}
+
+static uint64_t lookup(struct ddb *db, uint32_t i, int query)
+{
+    struct ddb_query_term terms[2];
+    struct ddb_query_clause clauses[2];
+
+    if (!query)
+        return count(ddb_getitem(db, &keys[i]));
+
+    memset(terms, 0, sizeof(terms));
+    terms[0].key = keys[i];
+    terms[1].key = keys[(i + 1) % num_keys];
+    clauses[0].terms = &terms[0];
+    clauses[1].terms = &terms[1];
+    clauses[0].num_terms = clauses[1].num_terms = 1;
+    return count(ddb_query(db, clauses, 2));
+}
+
+static void *run_lookups(void *arg)
+{
+    struct bench *b = (struct bench*)arg;
+    const uint64_t *ref = b->query ? query_counts: item_counts;
+    uint64_t i;
+
+    for (i = 0; i < b->num_ops; i++){
+        b->seed = b->seed * 1103515245 + 12345;
+        uint32_t k = (b->seed >> 8) % num_keys;
+        if (lookup(b->db, k, b->query) != ref[k]){
+            b->failed = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double run(struct ddb *db, uint32_t num_threads,
+                  uint64_t num_ops, int query)
+{
+    struct bench benches[num_threads];
+    double start;
+    uint32_t i;
+
+    memset(benches, 0, sizeof(benches));
+    start = now();
+    for (i = 0; i < num_threads; i++){
+        benches[i].db = db;
+        benches[i].query = query;
+        benches[i].seed = i + 1;
+        benches[i].num_ops = num_ops;
+        if (pthread_create(&benches[i].tid, NULL, run_lookups, &benches[i])){
+            fprintf(stderr, "Couldn't start a thread\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++){
+        pthread_join(benches[i].tid, NULL);
+        if (benches[i].failed){
+            fprintf(stderr, "Result mismatch in thread %u\n", i);
+            exit(1);
+        }
+    }
+    return now() - start;
+}
+
+static void bench(struct ddb *db, uint32_t max_threads,
+                  uint64_t num_ops, int query)
+{
+    double t, base = 0;
+    uint32_t i;
+
+    printf("%s\n", query ? "ddb_query": "ddb_getitem");
+    printf("threads\tops\tseconds\tops/s\tspeedup\n");
+    for (i = 1; i <= max_threads; i++){
+        t = run(db, i, num_ops, query);
+        if (i == 1)
+            base = t;
+        printf("%u\t%llu\t%.3f\t%.0f\t%.2f\n", i,
+               (long long unsigned int)(i * num_ops), t,
+               i * num_ops / t, base * i / t);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct ddb_cache *cache = NULL;
+    struct ddb_cursor *cur;
+    const struct ddb_entry *e;
+    struct ddb *db;
+    uint32_t i, max_threads;
+    uint64_t num_ops;
+    int fd, err;
+
+    if (argc < 3){
+        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "mtbench discodb max_threads [ops_per_thread]\n");
+        exit(1);
+    }
+    if (!(db = ddb_new())){
+        fprintf(stderr, "Couldn't initialize discodb: Out of memory\n");
+        exit(1);
+    }
+    if ((fd = open(argv[1], O_RDONLY)) == -1 || ddb_load(db, fd)){
+        fprintf(stderr, "Couldn't open discodb %s\n", argv[1]);
+        exit(1);
+    }
+    if (!(max_threads = atoi(argv[2])))
+        max_threads = 1;
+    num_ops = argc > 3 ? atoll(argv[3]): 100000;
+    if (getenv("CACHE")){
+        if (!(cache = ddb_cache_new(atoll(getenv("CACHE"))))){
+            fprintf(stderr, "Couldn't initialize cache: Out of memory\n");
+            exit(1);
+        }
+        ddb_set_cache(db, cache);
+    }
+
+    if (!(cur = ddb_keys(db))){
+        fprintf(stderr, "Couldn't list keys\n");
+        exit(1);
+    }
+    while (num_keys < MAX_KEYS && (e = ddb_next(cur, &err)))
+        keys[num_keys++] = *e;
+    ddb_free_cursor(cur);
+    if (!num_keys){
+        fprintf(stderr, "No keys in %s\n", argv[1]);
+        exit(1);
+    }
+
+    item_counts = calloc(num_keys, sizeof(uint64_t));
+    query_counts = calloc(num_keys, sizeof(uint64_t));
+    if (!item_counts || !query_counts){
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < num_keys; i++){
+        item_counts[i] = lookup(db, i, 0);
+        query_counts[i] = lookup(db, i, 1);
+    }
+
+    bench(db, max_threads, num_ops, 0);
+    bench(db, max_threads, num_ops, 1);
+
+    if (cache){
+        struct ddb_cache_stats stats;
+        ddb_cache_stats(cache, &stats);
+        printf("cache: %llu hits, %llu misses, %llu evictions, "
+               "%llu entries, %llu bytes\n",
+               (long long unsigned int)stats.hits,
+               (long long unsigned int)stats.misses,
+               (long long unsigned int)stats.evictions,
+               (long long unsigned int)stats.num_entries,
+               (long long unsigned int)stats.size);
+    }
+    free(item_counts);
+    free(query_counts);
+    ddb_free(db);
+    ddb_cache_free(cache);
+    return 0;
+}
@@ -0,0 +1,118 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <discodb.h>
+
+/* Measures how the throughput of a full scan over all values scales
+   with the number of threads, each thread scanning one partition
+   given by ddb_partition(). */
+
+struct scan{
+    pthread_t tid;
+    struct ddb *db;
+    uint32_t start;
+    uint32_t end;
+    uint64_t num_values;
+    uint64_t num_bytes;
+    int err;
+};
+
+static void *scan_values(void *arg)
+{
+    struct scan *s = (struct scan*)arg;
+    struct ddb_cursor *cur;
+    const struct ddb_entry *e;
+
+    if (!(cur = ddb_values_range(s->db, s->start, s->end))){
+        s->err = 1;
+        return NULL;
+    }
+    while ((e = ddb_next(cur, &s->err))){
+        ++s->num_values;
+        s->num_bytes += e->length;
+    }
+    ddb_free_cursor(cur);
+    return NULL;
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double run(struct ddb *db, uint32_t num_threads,
+                  uint64_t *num_values, uint64_t *num_bytes)
+{
+    struct scan scans[num_threads];
+    uint32_t bounds[num_threads + 1];
+    double start;
+    uint32_t i;
+
+    ddb_partition(db, num_threads, bounds);
+    memset(scans, 0, sizeof(scans));
+    start = now();
+    for (i = 0; i < num_threads; i++){
+        scans[i].db = db;
+        scans[i].start = bounds[i];
+        scans[i].end = bounds[i + 1];
+        if (pthread_create(&scans[i].tid, NULL, scan_values, &scans[i])){
+            fprintf(stderr, "Couldn't start a thread\n");
+            exit(1);
+        }
+    }
+    *num_values = *num_bytes = 0;
+    for (i = 0; i < num_threads; i++){
+        pthread_join(scans[i].tid, NULL);
+        if (scans[i].err){
+            fprintf(stderr, "Scan failed\n");
+            exit(1);
+        }
+        *num_values += scans[i].num_values;
+        *num_bytes += scans[i].num_bytes;
+    }
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    struct ddb *db;
+    uint32_t i, max_threads;
+    uint64_t num_values, num_bytes;
+    double t, base = 0;
+    int fd;
+
+    if (argc < 3){
+        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "parscan discodb max_threads\n");
+        exit(1);
+    }
+    if (!(db = ddb_new())){
+        fprintf(stderr, "Couldn't initialize discodb: Out of memory\n");
+        exit(1);
+    }
+    if ((fd = open(argv[1], O_RDONLY)) == -1 || ddb_load(db, fd)){
+        fprintf(stderr, "Couldn't open discodb %s\n", argv[1]);
+        exit(1);
+    }
+    if (!(max_threads = atoi(argv[2])))
+        max_threads = 1;
+
+    printf("threads\tvalues\tMB\tseconds\tvalues/s\tspeedup\n");
+    for (i = 1; i <= max_threads; i++){
+        t = run(db, i, &num_values, &num_bytes);
+        if (i == 1)
+            base = t;
+        printf("%u\t%llu\t%.1f\t%.3f\t%.0f\t%.2f\n", i,
+               (long long unsigned int)num_values,
+               num_bytes / (1024 * 1024.0), t, num_values / t, base / t);
+    }
+    ddb_free(db);
+    return 0;
+}
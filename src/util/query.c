@@ -8,6 +8,8 @@
 
 #include <discodb.h>
 
+static int print_multiplicity;
+
 static void print_cursor(struct ddb *db, struct ddb_cursor *cur)
 {
         if (!cur){
@@ -24,6 +26,8 @@ static void print_cursor(struct ddb *db, struct ddb_cursor *cur)
         int errno, i = 0;
         const struct ddb_entry *e;
         while ((e = ddb_next(cur, &errno))){
+                if (print_multiplicity)
+                        printf("%u\t", ddb_multiplicity(cur));
                 printf("%.*s\n", e->length, e->data);
                 ++i;
         }
@@ -56,6 +60,10 @@ static struct ddb_query_clause *parse_cnf(char **tokens, int num, int *num_claus
                         k = t;
                         continue;
                 }
+                if (getenv("VALUE_TERMS"))
+                        terms[t].type = DDB_TERM_VALUE;
+                else if (getenv("GLOB_TERMS") && strpbrk(tokens[i], "*?"))
+                        terms[t].type = DDB_TERM_GLOB;
                 if (tokens[i][0] == '~'){
                         terms[t].nnot = 1;
                         terms[t].key.data = &tokens[i][1];
@@ -96,6 +104,13 @@ static struct ddb_view *load_view(const char *file, struct ddb *db)
     if ((fd = open(file, O_RDONLY)) == -1)
         return NULL;
 
+    /* a view saved with SAVE_VIEW, or a list of values */
+    if ((view = ddb_view_load(db, fd))){
+        ddb_view_cons_free(cons);
+        close(fd);
+        return view;
+    }
+
     if (fstat(fd, &nfo))
         return NULL;
 
@@ -128,6 +143,82 @@ err:
     return NULL;
 }
 
+static void save_view(const char *file, struct ddb *db, struct ddb_cursor *cur)
+{
+    struct ddb_view *view;
+    const char *err;
+    int fd;
+
+    if (!cur || !(view = ddb_query_to_view(cur))){
+        ddb_error(db, &err);
+        fprintf(stderr, "Query failed: %s\n", err);
+        exit(1);
+    }
+    if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1){
+        fprintf(stderr, "Couldn't open %s\n", file);
+        exit(1);
+    }
+    if (ddb_view_dump(view, db, fd)){
+        ddb_error(db, &err);
+        fprintf(stderr, "Saving view to %s failed: %s\n", file, err);
+        exit(1);
+    }
+    fprintf(stderr, "View of %u values saved to %s\n",
+            ddb_view_size(view), file);
+    close(fd);
+    ddb_view_free(view);
+    ddb_free_cursor(cur);
+}
+
+/* Returns the view of the query, to be freed after it */
+static struct ddb_view *query_opts(struct ddb *db, struct ddb_query_opts *opts)
+{
+        char *view_file = getenv("VIEW");
+        struct ddb_view *view = NULL;
+        if (view_file){
+            if ((view = load_view(view_file, db))){
+                fprintf(stderr, "View loaded successfully (%d items)\n",
+                        ddb_view_size(view));
+            }else{
+                fprintf(stderr, "Loading view from %s failed\n", view_file);
+                exit(1);
+            }
+        }
+        memset(opts, 0, sizeof(*opts));
+        opts->view = view;
+        if (getenv("OFFSET"))
+            opts->offset = atoll(getenv("OFFSET"));
+        if (getenv("LIMIT"))
+            opts->limit = atoll(getenv("LIMIT"));
+        if (getenv("THREADS"))
+            opts->num_threads = atoi(getenv("THREADS"));
+        return view;
+}
+
+static void run_query(struct ddb *db, struct ddb_cursor *cur)
+{
+        uint64_t resident, fetched;
+        char plan[256];
+        if (cur && getenv("PLAN") && ddb_query_plan(cur, plan,
+                                        sizeof(plan)) != -1)
+            fprintf(stderr, "Plan: %s\n", plan);
+        if (cur && !ddb_readahead_stats(cur, &resident, &fetched))
+            fprintf(stderr, "Readahead: %llu pages resident, "
+                    "%llu pages fetched\n",
+                    (long long unsigned int)resident,
+                    (long long unsigned int)fetched);
+        char *mult = getenv("MULTIPLICITY");
+        if (cur && mult){
+            int mode = strcmp(mult, "sum") ?
+                DDB_MULTIPLICITY_MIN: DDB_MULTIPLICITY_SUM;
+            print_multiplicity = !ddb_cursor_multiplicity(cur, mode);
+        }
+        if (getenv("SAVE_VIEW"))
+            save_view(getenv("SAVE_VIEW"), db, cur);
+        else
+            print_cursor(db, cur);
+}
+
 static struct ddb *open_discodb(const char *file)
 {
         struct ddb *db;
@@ -141,7 +232,8 @@ static struct ddb *open_discodb(const char *file)
                 fprintf(stderr, "Couldn't open discodb %s\n", file);
                 exit(1);
         }
-        if (ddb_load(db, fd)){
+        if (ddb_load_flags(db, fd, 0,
+                getenv("READAHEAD") ? DDB_LOAD_QUERY_READAHEAD: 0)){
                 const char *err;
                 ddb_error(db, &err);
                 fprintf(stderr, "Invalid discodb in %s: %s\n", file, err);
@@ -166,6 +258,7 @@ static void print_info(struct ddb *db)
     printf("Number of keys:          %llu\n", FEAT(DDB_NUM_KEYS));
     printf("Number of items:         %llu\n", FEAT(DDB_NUM_VALUES));
     printf("Number of unique values: %llu\n", FEAT(DDB_NUM_UNIQUE_VALUES));
+    printf("Max value size:          %llu bytes\n", FEAT(DDB_MAX_VALUE_SIZE));
     printf("Compressed?              %s\n", boolstr(feat[DDB_IS_COMPRESSED]));
     printf("Hashed?                  %s\n", boolstr(feat[DDB_IS_HASHED]));
     printf("Multiset?                %s\n", boolstr(feat[DDB_IS_MULTISET]));
@@ -174,8 +267,9 @@ static void print_info(struct ddb *db)
 static void usage()
 {
         fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "query_discodb [discodb] [-keys|-values|-uvalues|-info|-item|-cnf] [query]\n");
+        fprintf(stderr, "query_discodb [discodb] [-keys|-values|-uvalues|-info|-prewarm|-item|-getkeys|-prefix|-between|-cnf|-query] [query]\n");
         fprintf(stderr, "cnf format example: a b & ~c d & e\n");
+        fprintf(stderr, "query format example: \"(a | b) & ~(c & *d)\"\n");
         exit(1);
 }
 
@@ -187,6 +281,9 @@ int main(int argc, char **argv)
         struct ddb *db = open_discodb(argv[1]);
         if (!strcmp(argv[2], "-info"))
                 print_info(db);
+        else if (!strcmp(argv[2], "-prewarm"))
+                printf("Prewarmed %llu bytes\n", (long long unsigned int)
+                        ddb_prewarm(db, DDB_SECTION_ALL));
         else if (!strcmp(argv[2], "-keys"))
                 print_cursor(db, ddb_keys(db));
 
@@ -205,6 +302,35 @@ int main(int argc, char **argv)
                 e.data = argv[3];
                 e.length = strlen(argv[3]);
                 print_cursor(db, ddb_getitem(db, &e));
+        }else if (!strcmp(argv[2], "-getkeys")){
+                if (argc < 4){
+                        fprintf(stderr, "Specify query\n");
+                        exit(1);
+                }
+                struct ddb_entry e;
+                e.data = argv[3];
+                e.length = strlen(argv[3]);
+                print_cursor(db, ddb_getkeys(db, &e));
+        }else if (!strcmp(argv[2], "-prefix")){
+                if (argc < 4){
+                        fprintf(stderr, "Specify query\n");
+                        exit(1);
+                }
+                struct ddb_entry e;
+                e.data = argv[3];
+                e.length = strlen(argv[3]);
+                print_cursor(db, ddb_keys_prefix(db, &e));
+        }else if (!strcmp(argv[2], "-between")){
+                if (argc < 5){
+                        fprintf(stderr, "Specify query\n");
+                        exit(1);
+                }
+                struct ddb_entry lo, hi;
+                lo.data = argv[3];
+                lo.length = strlen(argv[3]);
+                hi.data = argv[4];
+                hi.length = strlen(argv[4]);
+                print_cursor(db, ddb_keys_between(db, &lo, &hi));
         }else if (!strcmp(argv[2], "-cnf")){
                 if (argc < 4){
                         fprintf(stderr, "Specify query\n");
@@ -212,21 +338,29 @@ int main(int argc, char **argv)
                 }
                 int num_q = 0;
                 struct ddb_query_clause *q = parse_cnf(&argv[3], argc - 3, &num_q);
-                char *view_file = getenv("VIEW");
-                struct ddb_view *view = NULL;
-                if (view_file){
-                    if ((view = load_view(view_file, db))){
-                        fprintf(stderr, "View loaded successfully (%d items)\n",
-                                ddb_view_size(view));
-                    }else{
-                        fprintf(stderr, "Loading view from %s failed\n", view_file);
-                        exit(1);
-                    }
-                }
-                print_cursor(db, ddb_query_view(db, q, num_q, view));
+                struct ddb_query_opts opts;
+                struct ddb_view *view = query_opts(db, &opts);
+                run_query(db, ddb_query_with_opts(db, q, num_q, &opts));
                 free(q[0].terms);
                 free(q);
                 ddb_view_free(view);
+        }else if (!strcmp(argv[2], "-query")){
+                if (argc < 4){
+                        fprintf(stderr, "Specify query\n");
+                        exit(1);
+                }
+                struct ddb_prepared *q = ddb_prepare(db, argv[3], strlen(argv[3]));
+                if (!q){
+                        const char *err;
+                        ddb_error(db, &err);
+                        fprintf(stderr, "Query failed: %s\n", err);
+                        exit(1);
+                }
+                struct ddb_query_opts opts;
+                struct ddb_view *view = query_opts(db, &opts);
+                run_query(db, ddb_prepared_query(q, &opts));
+                ddb_prepared_free(q);
+                ddb_view_free(view);
         }else
                 usage();
 